@@ -0,0 +1,68 @@
+#!/usr/bin/python3
+# stand-in for the InfluxDB /write endpoint to test the influx push (src/influx.h) without a database.
+# accepts line protocol, checks that the timestamps of every series increase and prints a line per request
+#
+# usage: influx_standin.py [port] [first:last]
+#        requests number first to last (counted from 1) are answered with 503 to emulate an outage, e.g.
+#        influx_standin.py 8086 3:10 and .pio/build/native/program 2000 balanced 8086
+
+import http.server
+import sys
+
+requests = 0
+outage = (0, -1)
+last_time = {}
+lines_total = 0
+errors = 0
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+	def do_POST(self):
+		global requests, lines_total, errors
+
+		requests += 1
+		body = self.rfile.read(int(self.headers.get("Content-Length", 0))).decode()
+
+		if outage[0] <= requests <= outage[1]:
+			print("request %d: outage, 503" % requests)
+			self.send_response(503)
+			self.end_headers()
+			return
+
+		lines = body.splitlines()
+		times = []
+
+		for line in lines:
+			series, fields, time = line.rsplit(" ", 2)
+			time = int(time)
+			times.append(time)
+
+			if time <= last_time.get(series, 0):
+				print("  out of order or duplicate: %s" % line)
+				errors += 1
+			last_time[series] = time
+
+		lines_total += len(lines)
+		print("request %d: %d lines, %d..%d, %d lines total, %d errors" % (requests, len(lines), min(times) // 10**9, max(times) // 10**9, lines_total, errors))
+
+		self.send_response(204)
+		self.end_headers()
+
+	def log_message(self, format, *args):
+		pass
+
+
+def main():
+	global outage
+
+	port = int(sys.argv[1]) if len(sys.argv) > 1 else 8086
+
+	if len(sys.argv) > 2:
+		first, last = sys.argv[2].split(":")
+		outage = (int(first), int(last))
+
+	http.server.HTTPServer(("127.0.0.1", port), Handler).serve_forever()
+
+
+if __name__ == "__main__":
+	sys.exit(main())
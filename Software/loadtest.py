@@ -0,0 +1,105 @@
+#!/usr/bin/python3
+# load test of the web server on a meter: slow clients (request sent byte by byte, response read in small pieces)
+# and fast scrapers run concurrently while loop_duration_max_us on /status is watched. fails if the longest
+# loop() iteration exceeds the limit, i.e. if requests stall the sampling
+#
+# usage: loadtest.py http://meter [duration s] [limit us]
+
+import socket
+import sys
+import threading
+import time
+import urllib.parse
+import urllib.request
+
+SLOW_CLIENTS = 3
+FAST_SCRAPERS = 2
+SLOW_PATHS = ["/allmetrics", "/history", "/settings.json", "/"]
+FAST_PATHS = ["/metrics", "/allmetrics", "/metricsnew", "/metrics.bin", "/rollup", "/status"]
+
+running = True
+requests = {"slow": 0, "fast": 0, "errors": 0}
+
+
+def slow_client(host, port, index):
+	while running:
+		path = SLOW_PATHS[index % len(SLOW_PATHS)]
+		index += 1
+
+		try:
+			sock = socket.socket()
+			sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 512)
+			sock.settimeout(30)
+			sock.connect((host, port))
+
+			for byte in ("GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n" % (path, host)).encode():
+				sock.send(bytes([byte]))
+				time.sleep(0.05)
+
+			while running and sock.recv(64):
+				time.sleep(0.1)
+
+			sock.close()
+			requests["slow"] += 1
+		except OSError:
+			requests["errors"] += 1
+
+
+def fast_scraper(url, index):
+	while running:
+		path = FAST_PATHS[index % len(FAST_PATHS)]
+		index += 1
+
+		try:
+			urllib.request.urlopen(url + path, timeout=10).read()
+			requests["fast"] += 1
+		except OSError:
+			requests["errors"] += 1
+
+
+def loop_duration_max(url, reset=False):
+	for line in urllib.request.urlopen(url + "/status" + ("?reset_max=1&reset_histograms=1" if reset else ""), timeout=10).read().decode().splitlines():
+		if "loop_duration_max_us" in line:
+			return int(float(line.rsplit("=", 1)[1]))
+
+
+def main():
+	global running
+
+	if len(sys.argv) < 2:
+		print("usage: %s http://meter [duration s] [limit us]" % sys.argv[0])
+		return 1
+
+	url = sys.argv[1].rstrip("/")
+	duration = int(sys.argv[2]) if len(sys.argv) > 2 else 60
+	limit_us = int(sys.argv[3]) if len(sys.argv) > 3 else 20000
+
+	address = urllib.parse.urlparse(url)
+	loop_duration_max(url, reset=True)
+
+	threads = [threading.Thread(target=slow_client, args=(address.hostname, address.port or 80, i), daemon=True) for i in range(SLOW_CLIENTS)]
+	threads += [threading.Thread(target=fast_scraper, args=(url, i), daemon=True) for i in range(FAST_SCRAPERS)]
+
+	for thread in threads:
+		thread.start()
+
+	worst = 0
+	end = time.time() + duration
+
+	while time.time() < end:
+		time.sleep(5)
+		worst = max(worst, loop_duration_max(url))
+		print("loop_duration_max_us=%d slow=%d fast=%d errors=%d" % (worst, requests["slow"], requests["fast"], requests["errors"]))
+
+	running = False
+
+	if worst > limit_us:
+		print("FAILED: loop() blocked for %d us (limit %d us)" % (worst, limit_us))
+		return 1
+
+	print("ok: loop() never blocked for more than %d us" % worst)
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,169 @@
+#!/usr/bin/python3
+# reference decoder for the binary metrics encoding (/metrics.bin and the binary UDP push), see src/binary.h
+#
+# usage: metrics_binary.py http://meter            fetch /metrics.schema and /metrics.bin once
+#        metrics_binary.py http://meter 8001       fetch the schema, then decode UDP pushes on port 8001
+
+import socket
+import struct
+import sys
+import urllib.request
+
+BINARY_VERSION = 3
+BINARY_FLAG_LATEST = 1 << 0
+
+HEADER = struct.Struct("<4sBBBBIII")
+ENERGY_PHASES = "TABC"
+
+
+class Metric:
+	def __init__(self, name, phases, numerator, denominator, shift, decimals):
+		self.name = name
+		self.phases = phases
+		self.numerator = numerator
+		self.denominator = denominator
+		self.shift = shift
+		self.decimals = decimals
+
+
+def parse_schema(text):
+	metrics = []
+
+	for line in text.splitlines():
+		if (not line) or line.startswith("#"):
+			continue
+
+		name, phases, numerator, denominator, shift, decimals = line.split()
+		metrics.append(Metric(name, phases, int(numerator), int(denominator), int(shift), int(decimals)))
+
+	return metrics
+
+
+# same as makeSchemaHash() in src/readplan.h
+def schema_hash(metrics):
+	data = bytearray()
+
+	for metric in metrics:
+		data += metric.name.encode() + b"\0"
+		data += metric.phases.encode() + b"\0"
+		data += struct.pack("<hHBB", metric.numerator, metric.denominator, metric.shift, metric.decimals)
+
+	value = 2166136261
+	for byte in data:
+		value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+
+	return value
+
+
+def read_varint(data, offset):
+	bits = 0
+	shift = 0
+
+	while True:
+		byte = data[offset]
+		offset += 1
+		bits |= (byte & 0x7F) << shift
+		shift += 7
+
+		if not byte & 0x80:
+			break
+
+	# undo zigzag
+	return (bits >> 1) ^ -(bits & 1), offset
+
+
+# returns (header fields, samples), every sample is (offset_ms, [(name, phase, value)]).
+# energy totals are reported in kWh as name "energy", values that are not part of a sample are left out
+def decode(data, metrics):
+	magic, version, flags, value_count, energy_count, hash_value, uptime_s, sequence = HEADER.unpack_from(data)
+
+	if magic != b"TPMB":
+		raise ValueError("not a binary metrics packet")
+	if version != BINARY_VERSION:
+		raise ValueError("unsupported version %d" % version)
+	if hash_value != schema_hash(metrics):
+		raise ValueError("schema hash mismatch, reload /metrics.schema")
+	if value_count != sum(len(metric.phases) for metric in metrics):
+		raise ValueError("value count does not match the schema")
+
+	offset = HEADER.size
+	samples = []
+	raw_values = [0] * (value_count + energy_count)
+
+	while offset < len(data):
+		offset_ms, offset = read_varint(data, offset)
+
+		presence = data[offset:offset + (value_count + 7) // 8]
+		offset += len(presence)
+		present = [bool(presence[index // 8] & (1 << (index % 8))) for index in range(value_count)] + [True] * energy_count
+
+		# every sample after the first one contains differences to the last sample with the value
+		for index in range(len(raw_values)):
+			if present[index]:
+				raw, offset = read_varint(data, offset)
+				raw_values[index] += raw
+
+		values = []
+		index = 0
+
+		for metric in metrics:
+			for phase in metric.phases:
+				if present[index]:
+					values.append((metric.name, phase, raw_values[index] * metric.numerator / (metric.denominator << metric.shift)))
+				index += 1
+
+		for phase in ENERGY_PHASES[:energy_count]:
+			values.append(("energy", phase, raw_values[index] / 10000))
+			index += 1
+
+		samples.append((offset_ms, values))
+
+	header = {"flags": flags, "latest": bool(flags & BINARY_FLAG_LATEST), "uptime_s": uptime_s, "sequence": sequence}
+
+	return header, samples
+
+
+def print_packet(header, samples):
+	for offset_ms, values in samples:
+		print("# sequence=%d uptime_s=%d offset_ms=%d latest=%d" % (header["sequence"], header["uptime_s"], offset_ms, header["latest"]))
+
+		for name, phase, value in values:
+			print("%s,phase=%s value=%s" % (name, phase, value))
+
+
+def main():
+	if len(sys.argv) < 2:
+		print("usage: %s http://meter [udp port]" % sys.argv[0])
+		return 1
+
+	url = sys.argv[1].rstrip("/")
+	metrics = parse_schema(urllib.request.urlopen(url + "/metrics.schema").read().decode())
+
+	if len(sys.argv) < 3:
+		print_packet(*decode(urllib.request.urlopen(url + "/metrics.bin").read(), metrics))
+		return 0
+
+	sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+	sock.bind(("", int(sys.argv[2])))
+
+	expected = None
+
+	while True:
+		data = sock.recv(2048)
+
+		try:
+			header, samples = decode(data, metrics)
+		except ValueError as error:
+			print("dropped packet: %s" % error)
+			continue
+
+		# the sequence restarts at 0 when the meter reboots
+		if (expected is not None) and (header["sequence"] > expected):
+			print("# lost %d datagrams" % (header["sequence"] - expected))
+		expected = header["sequence"] + 1
+
+		print_packet(header, samples)
+
+
+if __name__ == "__main__":
+	sys.exit(main())
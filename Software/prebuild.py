@@ -1,7 +1,55 @@
 #!/usr/bin/python
-Import("env")
+# compresses the static web pages (web/*.html) into src/pages.h, where they are stored in flash (PROGMEM)
+# and sent with Content-Encoding: gzip. can also be run directly: python3 prebuild.py
+import gzip
+import os
+import re
 
-def prebuild(source, target, env):
-	print("test")
+def page_name(file_name):
+	return "page_" + re.sub("[^a-z0-9]", "_", file_name.lower())
 
-env.AddPreAction("build", prebuild)
+def generate(project_dir):
+	web_dir = os.path.join(project_dir, "web")
+	output = [
+		"// generated by prebuild.py from web/, do not edit",
+		"#ifndef PAGES_h",
+		"#define PAGES_h",
+		"",
+		"#include \"Arduino.h\"",
+		""]
+
+	for file_name in sorted(os.listdir(web_dir)):
+		with open(os.path.join(web_dir, file_name), "rb") as page:
+			lines = page.read().splitlines()
+
+		# indentation and empty lines only help reading the source
+		content = b"\n".join(line.strip() for line in lines if line.strip())
+		# fixed mtime, the output only changes with the pages
+		data = gzip.compress(content, 9, mtime=0)
+
+		output.append("// %s: %d bytes, %d bytes compressed" % (file_name, len(content), len(data)))
+		output.append("static const uint8_t %s[] PROGMEM = {" % page_name(file_name))
+		for offset in range(0, len(data), 16):
+			output.append("\t" + ", ".join("0x%02x" % byte for byte in data[offset:offset + 16]) + ",")
+		output.append("};")
+		output.append("")
+
+	output.append("#endif")
+
+	path = os.path.join(project_dir, "src", "pages.h")
+	text = "\n".join(output) + "\n"
+
+	# keep the timestamp if nothing changed, so nothing is recompiled
+	if os.path.exists(path):
+		with open(path) as previous:
+			if previous.read() == text:
+				return
+
+	with open(path, "w") as header:
+		header.write(text)
+
+try:
+	Import("env")
+	generate(env.subst("$PROJECT_DIR"))
+except NameError:
+	generate(os.path.dirname(os.path.abspath(__file__)))
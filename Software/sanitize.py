@@ -0,0 +1,5 @@
+#!/usr/bin/python
+Import("env")
+
+# build_flags are only passed to the compiler, the sanitizer runtime also has to be linked
+env.Append(LINKFLAGS=["-fsanitize=address,undefined"])
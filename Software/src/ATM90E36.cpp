@@ -1,49 +1,49 @@
 #include "Arduino.h"
-#include <SPI.h>
+#include "hal.h"
 #include "ATM90E36.h"
 #include "settings.h"
 
-#define ATM90_CS_PIN 16
-
 uint16_t readATM90E36(uint16_t address)
 {
-	SPISettings settings(500000, MSBFIRST, SPI_MODE2);
-	SPI.beginTransaction(settings);
+	uint16_t value;
+
+	readATM90E36Block(address, &value, 1);
 
-	digitalWrite(ATM90_CS_PIN, LOW);
-	delayMicroseconds(1);
+	return value;
+}
 
-	SPI.transfer16(address | (1 << 15));	// R/W flags
-	delayMicroseconds(4);
-	uint16_t value = SPI.transfer16(0xFFFF);
+void readATM90E36Block(uint16_t address, uint16_t *data, uint8_t count)
+{
+	halSpiSelect();
 
-	digitalWrite(ATM90_CS_PIN, HIGH);
+	halSpiTransfer16(address | (1 << 15));	// R/W flags
+	halDelayMicroseconds(4);
 
-	return value;
+	// the address is incremented by the chip after every word as long as CS stays low
+	while(count--)
+		*(data++) = halSpiTransfer16(0xFFFF);
+
+	halSpiDeselect();
 }
 
 void writeATM90E36(uint16_t address, uint16_t value)
 {
-	SPISettings settings(500000, MSBFIRST, SPI_MODE2);
-	SPI.beginTransaction(settings);
-
-	digitalWrite(ATM90_CS_PIN, LOW);
-	delayMicroseconds(1);
+	halSpiSelect();
 
-	SPI.transfer16(address);
-	delayMicroseconds(4);
-	SPI.transfer16(value);
+	halSpiTransfer16(address);
+	halDelayMicroseconds(4);
+	halSpiTransfer16(value);
 
-	digitalWrite(ATM90_CS_PIN, HIGH);
+	halSpiDeselect();
 }
 
 void initATM90E36()
 {
-	pinMode(ATM90_CS_PIN, OUTPUT);
+	halSpiInit();
 
 	writeATM90E36(SoftReset, 0x789A);   // Perform soft reset
 
-	delay(10);
+	halDelay(10);
 
 	//Set metering config values (CONFIG)
 	writeATM90E36(ConfigStart, 0x5678); // Metering calibration startup
@@ -57,10 +57,60 @@ void initATM90E36()
 	//Set measurement calibration values (ADJUST)
 	writeATM90E36(AdjStart, 0x5678);    // Measurement calibration
 
-	writeATM90E36(UgainA, (uint16_t)setting_voltage_gain[0]);      // A Voltage rms gain
-	writeATM90E36(UgainB, (uint16_t)setting_voltage_gain[1]);      // B Voltage rms gain
-	writeATM90E36(UgainC, (uint16_t)setting_voltage_gain[2]);      // C Voltage rms gain
-	writeATM90E36(IgainA, (uint16_t)setting_current_gain[0]);      // A line current gain
-	writeATM90E36(IgainB, (uint16_t)setting_current_gain[1]);      // B line current gain
-	writeATM90E36(IgainC, (uint16_t)setting_current_gain[2]);      // C line current gain
+	configureATM90E36();
+}
+
+// checksum of a register block: low byte = sum of all bytes, high byte = xor of all bytes
+uint16_t checksumATM90E36(const uint16_t *data, uint8_t count)
+{
+	uint8_t sum = 0;
+	uint8_t xor_all = 0;
+
+	while(count--)
+	{
+		sum += (*data >> 8) + (*data & 0xFF);
+		xor_all ^= (*data >> 8) ^ (*data & 0xFF);
+		data++;
+	}
+
+	return (xor_all << 8) | sum;
+}
+
+void configureATM90E36()
+{
+	// ZX0 = positive zero crossings of phase A voltage, ZX1 / ZX2 off, 0x0001 = zero crossing outputs disabled
+	uint16_t zx_config = (setting_zx_pin >= 0) ? 0x0078 : 0x0001;
+
+	if(readATM90E36(ZXConfig) != zx_config)
+		writeATM90E36(ZXConfig, zx_config);
+
+	// measurement calibration registers UgainA - IoffsetN, covered by CSThree
+	uint16_t adjust[CSThree - UgainA];
+	readATM90E36Block(UgainA, adjust, CSThree - UgainA);
+
+	const uint16_t gains[][2] = {
+		{UgainA, (uint16_t)setting_voltage_gain[0]},	// A Voltage rms gain
+		{UgainB, (uint16_t)setting_voltage_gain[1]},	// B Voltage rms gain
+		{UgainC, (uint16_t)setting_voltage_gain[2]},	// C Voltage rms gain
+		{IgainA, (uint16_t)setting_current_gain[0]},	// A line current gain
+		{IgainB, (uint16_t)setting_current_gain[1]},	// B line current gain
+		{IgainC, (uint16_t)setting_current_gain[2]}		// C line current gain
+	};
+
+	bool changed = false;
+
+	for(uint8_t i = 0; i < sizeof(gains) / sizeof(gains[0]); i++)
+	{
+		uint16_t &current = adjust[gains[i][0] - UgainA];
+
+		if(current == gains[i][1])
+			continue;
+
+		writeATM90E36(gains[i][0], gains[i][1]);
+		current = gains[i][1];
+		changed = true;
+	}
+
+	if(changed || (readATM90E36(CSThree) != checksumATM90E36(adjust, CSThree - UgainA)))
+		writeATM90E36(CSThree, checksumATM90E36(adjust, CSThree - UgainA));
 }
@@ -2,8 +2,13 @@
 #define ATM90E36_h
 
 uint16_t readATM90E36(uint16_t address);
+// read count consecutive registers starting at address in a single SPI burst
+void readATM90E36Block(uint16_t address, uint16_t *data, uint8_t count);
 void writeATM90E36(uint16_t address, uint16_t value);
+// soft reset and full configuration
 void initATM90E36();
+// write only the configuration / calibration registers that differ from the settings and update their checksum
+void configureATM90E36();
 
 /* STATUS REGISTERS */
 #define SoftReset 0x00 		// Software Reset
@@ -210,4 +215,21 @@ void initATM90E36();
 #define UangleB 0xFE		// B Voltage Phase Angle
 #define UangleC 0xFF		// C Voltage Phase Angle
 
+/* HARMONIC FOURIER ANALYSIS REGISTERS */
+// per channel: ratio of the 2nd - 32nd harmonic to the fundamental, followed by the THD
+#define AI_HR2 0x100		// A Current 2nd Harmonic Ratio
+#define BI_HR2 0x120		// B Current 2nd Harmonic Ratio
+#define CI_HR2 0x140		// C Current 2nd Harmonic Ratio
+#define AV_HR2 0x160		// A Voltage 2nd Harmonic Ratio
+#define BV_HR2 0x180		// B Voltage 2nd Harmonic Ratio
+#define CV_HR2 0x1A0		// C Voltage 2nd Harmonic Ratio
+#define AI_FUND 0x1C0		// A Current Fundamental Value
+#define AV_FUND 0x1C1		// A Voltage Fundamental Value
+#define BI_FUND 0x1C2		// B Current Fundamental Value
+#define BV_FUND 0x1C3		// B Voltage Fundamental Value
+#define CI_FUND 0x1C4		// C Current Fundamental Value
+#define CV_FUND 0x1C5		// C Voltage Fundamental Value
+#define DFT_SCALE 0x1D0		// DFT Scale
+#define DFT_CTRL 0x1D1		// DFT Start (cleared when the analysis is done)
+
 #endif
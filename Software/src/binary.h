@@ -0,0 +1,51 @@
+#ifndef BINARY_h
+#define BINARY_h
+
+#include <stdint.h>
+
+// compact binary encoding of the metrics for /metrics.bin and the binary UDP push (little endian):
+//   struct BinaryHeader
+//   samples until the end of the data, every sample consists of:
+//     offset of the sample to the first sample (ms), zigzag varint
+//     presence bitmap, BINARY_PRESENCE_LENGTH(value_count) bytes: bit (i % 8) of byte i / 8 is set if value i is
+//       part of the sample. the values of a tier that was not sampled since boot or a reset of the buffers are left out
+//     raw value of every present metric and phase, in the order of /metrics.schema, zigzag varints
+//     energy_count values: energy totals T, A, B, C (0.1 Wh), zigzag varints
+// /metrics.bin contains one sample. a push datagram contains up to setting_push_interval samples (see push.h),
+// the values of every sample after the first one are differences to the last sample of the datagram that contained
+// the value, or to 0 if there was none.
+//
+// zigzag varint: n = (v << 1) ^ (v >> 63) is sent in groups of 7 bits, least significant group first,
+// bit 7 is set in every byte but the last one.
+// value in its unit = raw * numerator / denominator / 2^shift, see /metrics.schema
+//
+// /metrics.schema describes the values, one line per metric after a comment line with version and schema_hash:
+//   name phases numerator denominator shift decimals
+// every character of phases is one value. schema_hash is computed by makeSchemaHash() (readplan.h),
+// a collector can check it against the schema it has loaded before. Software/metrics_binary.py is a reference decoder
+
+void handleMetricsBinary();
+void handleMetricsSchema();
+
+#define BINARY_VERSION 3
+
+// values are the latest samples instead of the averages
+#define BINARY_FLAG_LATEST (1 << 0)
+
+#define BINARY_ENERGY_COUNT 4
+
+#define BINARY_PRESENCE_LENGTH(value_count) (((value_count) + 7) / 8)
+
+struct BinaryHeader
+{
+	char magic[4];			// "TPMB"
+	uint8_t version;		// BINARY_VERSION
+	uint8_t flags;			// BINARY_FLAG_*
+	uint8_t value_count;
+	uint8_t energy_count;	// BINARY_ENERGY_COUNT
+	uint32_t schema_hash;
+	uint32_t uptime_s;		// time of the first sample (seconds since boot)
+	uint32_t sequence;		// push datagram sequence number, 0 for /metrics.bin
+};
+
+#endif
@@ -0,0 +1,193 @@
+#include "Arduino.h"
+#include "hal.h"
+#include "capture.h"
+#include "ATM90E36.h"
+#include "globals.h"
+
+enum CaptureState
+{
+	CAPTURE_IDLE = 0,
+	CAPTURE_RUNNING = 1,
+	CAPTURE_DONE = 2
+};
+
+enum CaptureState capture_state = CAPTURE_IDLE;
+
+struct CaptureHeader capture_header;
+// sample_count samples of the running or complete capture
+struct CaptureSample *capture_samples = NULL;
+// /capture.bin is being sent, bytes sent so far
+bool capture_sending = false;
+size_t capture_sent = 0;
+
+uint16_t capture_sample_count = 0;
+uint16_t capture_index = 0;
+unsigned long capture_next_us = 0;
+
+// parse an optional integer argument of the current request, returns false if it is malformed or out of range
+bool captureArg(const char *name, int64_t &value, int64_t min, int64_t max)
+{
+	if(!halHttpHasArg(name))
+		return true;
+
+	if(!parse_int64(value, halHttpArg(name).c_str()))
+		return false;
+
+	return (value >= min) && (value <= max);
+}
+
+void freeCapture()
+{
+	delete[] capture_samples;
+	capture_samples = NULL;
+	capture_state = CAPTURE_IDLE;
+}
+
+void handleCaptureStart()
+{
+	int64_t sample_count = CAPTURE_SAMPLES_MAX;
+	int64_t interval_us = 1000;
+
+	message_buffer.remove(0);
+
+	if(capture_sending)
+	{
+		halHttpSend(503, "text/plain", "capture download in progress");
+		return;
+	}
+
+	if(!captureArg("samples", sample_count, 1, CAPTURE_SAMPLES_MAX))
+	{
+		message_buffer += "samples must be 1 - " + String(CAPTURE_SAMPLES_MAX);
+		halHttpSend(400, "text/plain", message_buffer);
+		return;
+	}
+
+	if(!captureArg("interval_us", interval_us, CAPTURE_INTERVAL_MIN_US, CAPTURE_INTERVAL_MAX_US))
+	{
+		message_buffer += "interval_us must be " + String(CAPTURE_INTERVAL_MIN_US) + " - " + String(CAPTURE_INTERVAL_MAX_US);
+		halHttpSend(400, "text/plain", message_buffer);
+		return;
+	}
+
+	// a previous capture is replaced
+	freeCapture();
+	capture_samples = new struct CaptureSample[sample_count];
+
+	if(!capture_samples)
+	{
+		halHttpSend(503, "text/plain", "out of memory");
+		return;
+	}
+
+	memcpy(capture_header.magic, "TPCB", sizeof(capture_header.magic));
+	capture_header.version = CAPTURE_VERSION;
+	capture_header.channels = CAPTURE_CHANNELS;
+	capture_header.sample_count = 0;
+	capture_header.interval_us = interval_us;
+
+	capture_sample_count = sample_count;
+	capture_index = 0;
+	capture_next_us = halMicros();
+	capture_state = CAPTURE_RUNNING;
+
+	message_buffer += "capturing " + String(capture_sample_count) + " samples every " + String(capture_header.interval_us) + " us, download from /capture.bin";
+	halHttpSend(202, "text/plain", message_buffer);
+}
+
+// header, then the samples. both ends are little endian
+size_t fillCaptureData(void *context, char *buffer, size_t length)
+{
+	size_t total = sizeof(capture_header) + capture_header.sample_count * sizeof(struct CaptureSample);
+	size_t filled = 0;
+
+	while((filled < length) && (capture_sent < total))
+	{
+		bool header = capture_sent < sizeof(capture_header);
+		const char *data = header ? (const char*)&capture_header + capture_sent : (const char*)capture_samples + (capture_sent - sizeof(capture_header));
+		size_t piece = min(length - filled, header ? sizeof(capture_header) - capture_sent : total - capture_sent);
+
+		memcpy(buffer + filled, data, piece);
+		capture_sent += piece;
+		filled += piece;
+	}
+
+	return filled;
+}
+
+void captureDataSent(void *context)
+{
+	capture_sending = false;
+	freeCapture();
+}
+
+void handleCaptureData()
+{
+	if(capture_sending)
+	{
+		halHttpSend(503, "text/plain", "capture download in progress");
+		return;
+	}
+
+	if(capture_state != CAPTURE_DONE)
+	{
+		message_buffer.remove(0);
+		message_buffer += (capture_state == CAPTURE_RUNNING) ? "capture in progress" : "no capture, start one with /capture";
+		halHttpSend((capture_state == CAPTURE_RUNNING) ? 503 : 404, "text/plain", message_buffer);
+		return;
+	}
+
+	// sent straight from the capture buffer, which is freed afterwards
+	capture_sending = true;
+	capture_sent = 0;
+
+	halHttpSendFill(200, "application/octet-stream", fillCaptureData, NULL, captureDataSent);
+}
+
+void handleCapture()
+{
+	if(capture_state != CAPTURE_RUNNING)
+		return;
+
+	unsigned long starttime = halMicros();
+
+	do
+	{
+		unsigned long now = halMicros();
+
+		// only wait for samples that are due within this slice
+		if((long)(capture_next_us - now) >= CAPTURE_SLICE_BUDGET_US)
+			return;
+
+		if((long)(now - capture_next_us) < 0)
+			continue;
+
+		// UrmsA - IrmsC in one burst, IrmsN0 in between is dropped
+		uint16_t registers[IrmsC - UrmsA + 1];
+		readATM90E36Block(UrmsA, registers, IrmsC - UrmsA + 1);
+
+		struct CaptureSample &sample = capture_samples[capture_index];
+
+		if(!capture_index)
+			capture_header.start_time_us = now;
+
+		sample.time_us = now - capture_header.start_time_us;
+		for(uint8_t phase = 0; phase < 3; phase++)
+		{
+			sample.values[phase] = registers[phase];
+			sample.values[3 + phase] = registers[IrmsA - UrmsA + phase];
+		}
+
+		// the real sample times are recorded, so late samples do not shift the following ones
+		capture_next_us += capture_header.interval_us;
+		if((long)(now - capture_next_us) > 0)
+			capture_next_us = now;
+
+		if(++capture_index >= capture_sample_count)
+		{
+			capture_header.sample_count = capture_index;
+			capture_state = CAPTURE_DONE;
+			return;
+		}
+	} while((halMicros() - starttime) < CAPTURE_SLICE_BUDGET_US);
+}
@@ -0,0 +1,47 @@
+#ifndef CAPTURE_h
+#define CAPTURE_h
+
+// fast capture of the rms voltage and current registers of all phases, for events
+// (inrush, sags) that are hidden by the averaged metrics.
+// raw ADC samples would need the DMA output of the ATM90E36, but DMA_CTRL is tied to GND on the main board.
+//
+// the samples are kept on the heap from /capture until /capture.bin has been sent (or the client has gone away),
+// a capture can be downloaded once.
+//
+// binary format of /capture.bin (little endian):
+//   struct CaptureHeader
+//   sample_count * struct CaptureSample
+
+void handleCaptureStart();
+void handleCaptureData();
+// takes the samples of a running capture, call from loop()
+void handleCapture();
+
+#define CAPTURE_CHANNELS 6
+#define CAPTURE_SAMPLES_MAX 256
+#define CAPTURE_INTERVAL_MIN_US 500
+#define CAPTURE_INTERVAL_MAX_US 1000000
+// time spent waiting for and reading capture samples per loop() iteration
+#define CAPTURE_SLICE_BUDGET_US 2000
+
+#define CAPTURE_VERSION 1
+
+struct CaptureHeader
+{
+	char magic[4];			// "TPCB"
+	uint8_t version;		// CAPTURE_VERSION
+	uint8_t channels;		// CAPTURE_CHANNELS
+	uint16_t sample_count;
+	uint32_t interval_us;	// requested sample interval
+	uint32_t start_time_us;	// halMicros() at the first sample
+};
+
+struct CaptureSample
+{
+	// time since the first sample
+	uint32_t time_us;
+	// UrmsA - UrmsC (0.01 V), IrmsA - IrmsC (0.001 A)
+	uint16_t values[CAPTURE_CHANNELS];
+};
+
+#endif
@@ -0,0 +1,125 @@
+#include "Arduino.h"
+#include "format.h"
+
+// write the digits of value, at least min_digits (zero padded), returns the number of digits
+uint8_t formatDigits(char *buffer, uint64_t value, uint8_t min_digits)
+{
+	char digits[20];
+	uint8_t count = 0;
+
+	do
+	{
+		digits[count++] = '0' + value % 10;
+		value /= 10;
+	} while(value || (count < min_digits));
+
+	for(uint8_t i = 0; i < count; i++)
+		buffer[i] = digits[count - 1 - i];
+
+	return count;
+}
+
+uint8_t formatInteger(char *buffer, int64_t value)
+{
+	uint8_t length = 0;
+
+	if(value < 0)
+		buffer[length++] = '-';
+
+	// negate in unsigned arithmetic, INT64_MIN has no positive counterpart
+	uint64_t magnitude = (value < 0) ? -(uint64_t)value : value;
+
+	length += formatDigits(buffer + length, magnitude, 1);
+	buffer[length] = 0;
+
+	return length;
+}
+
+int64_t divideRounded(int64_t numerator, int64_t denominator)
+{
+	if(denominator < 0)
+	{
+		numerator = -numerator;
+		denominator = -denominator;
+	}
+
+	if(numerator < 0)
+		return -((-numerator + denominator / 2) / denominator);
+
+	return (numerator + denominator / 2) / denominator;
+}
+
+uint8_t formatFixed(char *buffer, int64_t numerator, int64_t denominator, uint8_t decimals)
+{
+	uint64_t scale = 1;
+
+	for(uint8_t i = 0; i < decimals; i++)
+		scale *= 10;
+
+	if(denominator < 0)
+	{
+		numerator = -numerator;
+		denominator = -denominator;
+	}
+
+	bool negative = (numerator < 0);
+	uint64_t magnitude = negative ? -(uint64_t)numerator : numerator;
+
+	// value in units of 10^-decimals
+	uint64_t scaled = (magnitude * scale + (uint64_t)denominator / 2) / (uint64_t)denominator;
+
+	uint8_t length = 0;
+
+	// no minus sign for values that round to zero
+	if(negative && scaled)
+		buffer[length++] = '-';
+
+	length += formatDigits(buffer + length, scaled / scale, 1);
+
+	if(decimals)
+	{
+		buffer[length++] = '.';
+		length += formatDigits(buffer + length, scaled % scale, decimals);
+	}
+
+	buffer[length] = 0;
+
+	return length;
+}
+
+uint8_t formatHex(char *buffer, uint32_t value)
+{
+	const char *hex_digits = "0123456789abcdef";
+	char digits[8];
+	uint8_t count = 0;
+
+	do
+	{
+		digits[count++] = hex_digits[value & 0xF];
+		value >>= 4;
+	} while(value);
+
+	for(uint8_t i = 0; i < count; i++)
+		buffer[i] = digits[count - 1 - i];
+
+	buffer[count] = 0;
+
+	return count;
+}
+
+uint8_t formatVarint(uint8_t *buffer, int64_t value)
+{
+	// zigzag: small negative values get short codes as well
+	uint64_t bits = ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+	uint8_t length = 0;
+
+	while(bits >= 0x80)
+	{
+		buffer[length++] = (bits & 0x7F) | 0x80;
+		bits >>= 7;
+	}
+
+	buffer[length++] = bits;
+
+	return length;
+}
@@ -0,0 +1,24 @@
+#ifndef FORMAT_h
+#define FORMAT_h
+
+// number formatting without floating point and without heap allocations.
+// all functions write into a caller supplied buffer of at least FORMAT_BUFFER_LENGTH bytes,
+// zero terminate it and return the number of characters written
+
+#define FORMAT_BUFFER_LENGTH 24
+
+uint8_t formatInteger(char *buffer, int64_t value);
+// numerator / denominator with decimals fractional digits, rounded half away from zero.
+// |numerator| * 10^decimals must fit into 64 bits
+uint8_t formatFixed(char *buffer, int64_t numerator, int64_t denominator, uint8_t decimals);
+// lower case hex digits without prefix and leading zeros
+uint8_t formatHex(char *buffer, uint32_t value);
+// zigzag varint (see binary.h), writes at most VARINT_LENGTH_MAX bytes and no terminating zero
+#define VARINT_LENGTH_MAX 10
+// longest varint of a value that fits into 32 bits
+#define VARINT32_LENGTH_MAX 5
+uint8_t formatVarint(uint8_t *buffer, int64_t value);
+// numerator / denominator rounded half away from zero
+int64_t divideRounded(int64_t numerator, int64_t denominator);
+
+#endif
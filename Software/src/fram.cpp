@@ -1,10 +1,10 @@
 #include "Arduino.h"
-#include <Wire.h>
+#include "hal.h"
 #include "fram.h"
 
 void initFRAM()
 {
-	Wire.begin(5, 4);
+	halI2cInit();
 }
 
 void readFram(uint8_t *data, uint16_t address, uint8_t length)
@@ -12,23 +12,20 @@ void readFram(uint8_t *data, uint16_t address, uint8_t length)
 	// all values are stored in 8 byte blocks
 	address *= sizeof(int64_t);
 
-	// deal with maximum read size of wire library, BUFFER_LENGTH is defined in Wire.h
+	// deal with maximum read size of the I2C driver
 	while(length)
 	{
 		uint8_t sublength = length;
-		if(sublength > BUFFER_LENGTH)
-			sublength = BUFFER_LENGTH;
+		if(sublength > HAL_I2C_BUFFER_LENGTH)
+			sublength = HAL_I2C_BUFFER_LENGTH;
 
-		Wire.beginTransmission(FRAM_ADDRESS);
+		uint8_t address_bytes[] = {(uint8_t)(address >> 8), (uint8_t)(address & 0xFF)};
 
-		Wire.write((uint8_t)(address >> 8));
-		Wire.write((uint8_t)(address & 0xFF));
+		halI2cBeginWrite(FRAM_ADDRESS);
+		halI2cWrite(address_bytes, sizeof(address_bytes));
+		halI2cEndWrite(false);
 
-		Wire.endTransmission(false);
-		Wire.requestFrom((uint8_t)FRAM_ADDRESS, sublength);
-
-		while(Wire.available())
-			*(data++) = Wire.read();
+		data += halI2cRead(FRAM_ADDRESS, data, sublength);
 
 		address += sublength;
 		length -= sublength;
@@ -39,12 +36,22 @@ void writeFram(uint8_t *data, uint16_t address, uint8_t length)
 {
 	address *= sizeof(int64_t);
 
-	Wire.beginTransmission(FRAM_ADDRESS);
+	// the two address bytes share the I2C buffer with the data
+	while(length)
+	{
+		uint8_t sublength = length;
+		if(sublength > HAL_I2C_BUFFER_LENGTH - 2)
+			sublength = HAL_I2C_BUFFER_LENGTH - 2;
 
-	Wire.write((uint8_t)(address >> 8));
-	Wire.write((uint8_t)(address & 0xFF));
+		uint8_t address_bytes[] = {(uint8_t)(address >> 8), (uint8_t)(address & 0xFF)};
 
-	Wire.write(data, length);
+		halI2cBeginWrite(FRAM_ADDRESS);
+		halI2cWrite(address_bytes, sizeof(address_bytes));
+		halI2cWrite(data, sublength);
+		halI2cEndWrite(true);
 
-	Wire.endTransmission();
+		data += sublength;
+		address += sublength;
+		length -= sublength;
+	}
 }
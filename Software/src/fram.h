@@ -10,4 +10,12 @@ void writeFram(uint8_t *data, uint16_t address, uint8_t length);
 
 #define FRAM_TOTAL 0x00		// length: 4x int64
 
+// history log (see history.h) and influx spool (see influx.h), settings end at 0xF0
+#define FRAM_HISTORY_HEADER 0xF0	// length: 2 blocks
+#define FRAM_SPOOL_HEADER 0xF8		// length: 2 blocks
+#define FRAM_HISTORY_START 0x100
+#define FRAM_HISTORY_END 0x340		// 96 records, one day
+#define FRAM_SPOOL_START 0x340
+#define FRAM_SPOOL_END 0x400		// end of the 8 KB MB85RC64
+
 #endif
@@ -7,6 +7,8 @@ unsigned long uptime_seconds = 0;
 double loop_duration = 0;
 double loop_duration_max = 0;
 
+String message_buffer = "";
+
 // must be zero terminated
 bool parse_int64(int64_t &output, const char *input)
 {
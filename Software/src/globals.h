@@ -9,7 +9,8 @@ extern unsigned long uptime_seconds;
 extern double loop_duration;
 extern double loop_duration_max;
 
-#define SCRIPT_SET_BACKURL "<script>document.getElementById('backurl_element').value = window.location.href.split('?')[0];</script>"
+// shared buffer for building push messages and short http replies, longer responses are streamed (see response.h)
+extern String message_buffer;
 
 // must be zero terminated
 bool parse_int64(int64_t &output, const char *input);
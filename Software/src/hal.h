@@ -0,0 +1,109 @@
+#ifndef HAL_h
+#define HAL_h
+
+#include "Arduino.h"
+
+// thin hardware abstraction layer, implemented by hal_esp8266.cpp on the meter
+// and by native/hal_native.cpp for the host build
+
+/* CLOCK */
+unsigned long halMillis();
+unsigned long halMicros();
+void halDelay(unsigned long ms);
+void halDelayMicroseconds(unsigned int us);
+
+/* ATM90E36 SPI BUS */
+void halSpiInit();
+// assert / release chip select of the ATM90E36, halSpiSelect also applies the bus settings
+void halSpiSelect();
+void halSpiDeselect();
+uint16_t halSpiTransfer16(uint16_t data);
+
+/* FRAM I2C BUS */
+// maximum number of bytes that can be read in one request
+#define HAL_I2C_BUFFER_LENGTH 32
+
+void halI2cInit();
+void halI2cBeginWrite(uint8_t device);
+void halI2cWrite(const uint8_t *data, uint8_t length);
+// stop = false keeps the bus for a repeated start
+void halI2cEndWrite(bool stop);
+// read length bytes from device, returns the number of bytes received
+uint8_t halI2cRead(uint8_t device, uint8_t *data, uint8_t length);
+
+/* ZERO CROSSING INPUT */
+// count rising edges on pin in an interrupt, pin < 0 disables the interrupt
+void halZeroCrossingBegin(int8_t pin);
+// number of zero crossings since halZeroCrossingBegin and the time of the latest one (consistent pair)
+void halZeroCrossingRead(uint32_t &count, unsigned long &time_us);
+
+/* HTTP SERVER */
+// the handlers must not block: they render their response into memory, the TCP stack sends it
+// while loop() continues. handlers may run while loop() waits in a blocking network call
+#define HAL_HTTP_GET 0
+#define HAL_HTTP_POST 1
+void halHttpOn(const char *path, uint8_t method, void (*handler)());
+// firmware update at path, protected with basic authentication
+void halHttpOnUpdate(const char *path, const char *username, const char *password);
+void halHttpBegin();
+// deferred work of the server (restart), call from loop()
+void halHttpHandle();
+// restart once the current response has been sent
+void halRestart();
+
+/* HTTP SERVER (current request) */
+void halHttpSend(int code, const char *content_type, const String &content);
+void halHttpSendHeader(const char *name, const String &value);
+bool halHttpHasArg(const char *name);
+String halHttpArg(const char *name);
+// response with a body that is passed in pieces with halHttpSendContent() and finished with halHttpEndContent().
+// the server keeps the whole body in the heap until it has been sent, only for bodies of a few kB
+// (length = HAL_HTTP_LENGTH_UNKNOWN if it is not known in advance)
+#define HAL_HTTP_LENGTH_UNKNOWN ((size_t)-1)
+void halHttpBeginContent(int code, const char *content_type, size_t length);
+void halHttpSendContent(const char *data, size_t length);
+void halHttpEndContent();
+// response with a body of any length that is sent chunked: fill(context, buffer, length) is called whenever the
+// TCP stack can take more data (outside of the request handler) and copies up to length bytes of the body into
+// buffer, it returns the number of bytes, 0 at the end of the body. done(context) is called once the response has
+// been sent or the client has gone away
+typedef size_t (*HalHttpFill)(void *context, char *buffer, size_t length);
+void halHttpSendFill(int code, const char *content_type, HalHttpFill fill, void *context, void (*done)(void *context));
+// gzip compressed content stored in flash (PROGMEM), sent with Content-Encoding: gzip
+void halHttpSendStatic(int code, const char *content_type, const uint8_t *gzip_data, size_t length);
+
+/* UDP */
+void halUdpBegin(uint16_t port);
+// returns false if the datagram could not be sent
+bool halUdpSend(const uint8_t address[4], uint16_t port, const char *data, size_t length);
+
+/* HTTP CLIENT (one request at a time) */
+// starts a POST of body to http://host:port/path in the background and returns right away, false if the previous
+// POST is still running. body has to stay unchanged until the result is known
+#define HAL_HTTP_POST_TIMEOUT_MS 1500
+bool halHttpPostBegin(const char *host, uint16_t port, const char *path, const char *content_type, const char *body, size_t length);
+// HAL_HTTP_POST_PENDING while the POST is running, then its HTTP status code or a negative value if the server could
+// not be reached or did not answer within HAL_HTTP_POST_TIMEOUT_MS
+#define HAL_HTTP_POST_PENDING 0
+int halHttpPostResult();
+
+/* TCP CLIENT (one connection) */
+// starts connecting to host:port in the background and returns right away, false if that is not possible.
+// an open connection is closed first
+bool halTcpConnect(const char *host, uint16_t port);
+// true while the name lookup and handshake are running, then halTcpConnected() tells whether they succeeded
+bool halTcpConnecting();
+bool halTcpConnected();
+// returns the number of bytes accepted by the send buffer
+size_t halTcpWrite(const uint8_t *data, size_t length);
+// reads up to length bytes that have arrived, does not block
+size_t halTcpRead(uint8_t *data, size_t length);
+void halTcpClose();
+
+/* WALL CLOCK */
+// start synchronizing the wall clock (SNTP)
+void halTimeBegin();
+// seconds since 1970, 0 while the clock is not synchronized yet
+uint32_t halEpochSeconds();
+
+#endif
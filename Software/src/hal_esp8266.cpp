@@ -0,0 +1,556 @@
+#include "Arduino.h"
+#include <SPI.h>
+#include <Wire.h>
+#include <WiFiUdp.h>
+#include <ESPAsyncTCP.h>
+#include <ESPAsyncWebServer.h>
+#include <Updater.h>
+#include <time.h>
+
+#include "hal.h"
+#include "histogram.h"
+
+#define ATM90_CS_PIN 16
+
+#define FRAM_SDA_PIN 5
+#define FRAM_SCL_PIN 4
+
+#define NTP_SERVER "pool.ntp.org"
+// any time before the firmware was built means the clock has not been set by SNTP
+#define EPOCH_VALID_MIN 1600000000
+
+WiFiUDP halUdp;
+// connection of the TCP client, the received bytes wait in a ring buffer until halTcpRead(). more than that is
+// never expected (the MQTT broker only answers with a few bytes per packet), an overflow breaks the connection
+AsyncClient hal_tcp;
+bool hal_tcp_connecting = false;
+bool hal_tcp_overflow = false;
+#define HAL_TCP_RX_LENGTH 256
+uint8_t hal_tcp_rx[HAL_TCP_RX_LENGTH];
+uint16_t hal_tcp_rx_first = 0;
+uint16_t hal_tcp_rx_count = 0;
+
+// requests are handled in the callbacks of the TCP stack, which run between two loop() iterations
+// (or while the loop waits in delay() / yield()), the handlers never interrupt a SPI or I2C transfer
+AsyncWebServer hal_http_server(80);
+AsyncWebServerRequest *hal_request = NULL;
+AsyncResponseStream *hal_stream = NULL;
+
+#define HAL_HTTP_HEADERS_MAX 2
+String hal_header_names[HAL_HTTP_HEADERS_MAX];
+String hal_header_values[HAL_HTTP_HEADERS_MAX];
+uint8_t hal_header_count = 0;
+
+// request that is writing the firmware (one upload at a time) and whether all of its upload was written
+AsyncWebServerRequest *hal_update_request = NULL;
+bool hal_update_complete = false;
+
+// time of halRestart(), the response is sent before the restart
+#define HAL_RESTART_DELAY_MS 500
+unsigned long hal_restart_ms = 0;
+
+// POST of halHttpPostBegin(): request header, body of the caller and the bytes of both that have been handed to the
+// TCP stack. the status line of the answer is collected until the status code is complete
+AsyncClient hal_post_client;
+String hal_post_header;
+const char *hal_post_body = NULL;
+size_t hal_post_length = 0;
+size_t hal_post_sent = 0;
+bool hal_post_running = false;
+int hal_post_result = HAL_HTTP_POST_PENDING;
+unsigned long hal_post_start_ms = 0;
+// "HTTP/1.1 204"
+#define HAL_POST_STATUS_LENGTH 12
+char hal_post_status[HAL_POST_STATUS_LENGTH + 1];
+uint8_t hal_post_status_length = 0;
+
+int8_t hal_zx_pin = -1;
+volatile uint32_t hal_zx_count = 0;
+volatile unsigned long hal_zx_time_us = 0;
+
+unsigned long halMillis()
+{
+	return millis();
+}
+
+unsigned long halMicros()
+{
+	return micros();
+}
+
+void halDelay(unsigned long ms)
+{
+	delay(ms);
+}
+
+void halDelayMicroseconds(unsigned int us)
+{
+	delayMicroseconds(us);
+}
+
+void halSpiInit()
+{
+	SPI.begin();
+	pinMode(ATM90_CS_PIN, OUTPUT);
+	digitalWrite(ATM90_CS_PIN, HIGH);
+}
+
+void halSpiSelect()
+{
+	SPISettings settings(500000, MSBFIRST, SPI_MODE2);
+	SPI.beginTransaction(settings);
+
+	digitalWrite(ATM90_CS_PIN, LOW);
+	delayMicroseconds(1);
+}
+
+void halSpiDeselect()
+{
+	digitalWrite(ATM90_CS_PIN, HIGH);
+}
+
+uint16_t halSpiTransfer16(uint16_t data)
+{
+	return SPI.transfer16(data);
+}
+
+void halI2cInit()
+{
+	Wire.begin(FRAM_SDA_PIN, FRAM_SCL_PIN);
+}
+
+void halI2cBeginWrite(uint8_t device)
+{
+	Wire.beginTransmission(device);
+}
+
+void halI2cWrite(const uint8_t *data, uint8_t length)
+{
+	Wire.write(data, length);
+}
+
+void halI2cEndWrite(bool stop)
+{
+	Wire.endTransmission(stop);
+}
+
+uint8_t halI2cRead(uint8_t device, uint8_t *data, uint8_t length)
+{
+	uint8_t received = 0;
+
+	Wire.requestFrom(device, length);
+
+	while(Wire.available() && (received < length))
+		data[received++] = Wire.read();
+
+	return received;
+}
+
+void IRAM_ATTR halZeroCrossingInterrupt()
+{
+	hal_zx_time_us = micros();
+	hal_zx_count++;
+}
+
+void halZeroCrossingBegin(int8_t pin)
+{
+	if(hal_zx_pin >= 0)
+		detachInterrupt(digitalPinToInterrupt(hal_zx_pin));
+
+	hal_zx_pin = pin;
+	hal_zx_count = 0;
+
+	if(pin < 0)
+		return;
+
+	pinMode(pin, INPUT);
+	attachInterrupt(digitalPinToInterrupt(pin), halZeroCrossingInterrupt, RISING);
+}
+
+void halZeroCrossingRead(uint32_t &count, unsigned long &time_us)
+{
+	noInterrupts();
+	count = hal_zx_count;
+	time_us = hal_zx_time_us;
+	interrupts();
+}
+
+void halHttpOn(const char *path, uint8_t method, void (*handler)())
+{
+	hal_http_server.on(path, (method == HAL_HTTP_POST) ? HTTP_POST : HTTP_GET, [handler](AsyncWebServerRequest *request)
+	{
+		unsigned long start = micros();
+
+		hal_request = request;
+		hal_header_count = 0;
+
+		handler();
+
+		hal_request = NULL;
+
+		histogramAdd(histogram_http, micros() - start);
+	});
+}
+
+// firmware upload form (GET) and upload (POST, multipart file, see upload.sh), protected by basic authentication
+void halHttpOnUpdate(const char *path, const char *username, const char *password)
+{
+	hal_http_server.on(path, HTTP_GET, [username, password](AsyncWebServerRequest *request)
+	{
+		if(!request->authenticate(username, password))
+			return request->requestAuthentication();
+
+		request->send(200, "text/html", "<form method='POST' enctype='multipart/form-data'><input type='file' name='firmware'>"
+			"<input type='submit' value='Update'></form>");
+	});
+
+	hal_http_server.on(path, HTTP_POST, [username, password](AsyncWebServerRequest *request)
+	{
+		if(!request->authenticate(username, password))
+			return request->requestAuthentication();
+
+		// only the request that wrote the firmware can complete the update
+		bool success = (hal_update_request == request) && hal_update_complete && !Update.hasError();
+
+		if(hal_update_request == request)
+			hal_update_request = NULL;
+
+		AsyncWebServerResponse *response = request->beginResponse(success ? 200 : 500, "text/plain", success ? "update ok, rebooting" : "update failed");
+		response->addHeader("Connection", "close");
+		request->send(response);
+
+		if(success)
+			halRestart();
+	},
+	[username, password](AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data, size_t length, bool final)
+	{
+		if(!index)
+		{
+			if(hal_update_request || !request->authenticate(username, password))
+				return;
+
+			hal_update_request = request;
+			hal_update_complete = false;
+
+			// an aborted upload releases the updater for the next one
+			request->onDisconnect([request]()
+			{
+				if(hal_update_request != request)
+					return;
+
+				Update.end(false);
+				hal_update_request = NULL;
+			});
+
+			Update.runAsync(true);
+			Update.begin((ESP.getFreeSketchSpace() - 0x1000) & 0xFFFFF000);
+		}
+
+		if(hal_update_request != request)
+			return;
+
+		Update.write(data, length);
+
+		if(final)
+			hal_update_complete = Update.end(true);
+	});
+}
+
+void halHttpBegin()
+{
+	hal_http_server.begin();
+}
+
+void halHttpHandle()
+{
+	if(hal_restart_ms && (millis() - hal_restart_ms > HAL_RESTART_DELAY_MS))
+		ESP.restart();
+}
+
+void halRestart()
+{
+	hal_restart_ms = millis() | 1;
+}
+
+// headers set with halHttpSendHeader() before the response was created
+void addPendingHeaders(AsyncWebServerResponse *response)
+{
+	for(uint8_t i = 0; i < hal_header_count; i++)
+		response->addHeader(hal_header_names[i], hal_header_values[i]);
+
+	hal_header_count = 0;
+}
+
+void halHttpSend(int code, const char *content_type, const String &content)
+{
+	AsyncWebServerResponse *response = hal_request->beginResponse(code, content_type, content);
+
+	addPendingHeaders(response);
+	hal_request->send(response);
+}
+
+void halHttpSendHeader(const char *name, const String &value)
+{
+	if(hal_header_count >= HAL_HTTP_HEADERS_MAX)
+		return;
+
+	hal_header_names[hal_header_count] = name;
+	hal_header_values[hal_header_count] = value;
+	hal_header_count++;
+}
+
+bool halHttpHasArg(const char *name)
+{
+	return hal_request->hasArg(name);
+}
+
+String halHttpArg(const char *name)
+{
+	return hal_request->arg(name);
+}
+
+// the body is collected in the heap and sent by the TCP stack after the handler has returned, with a Content-Length.
+// long bodies are sent with halHttpSendFill()
+void halHttpBeginContent(int code, const char *content_type, size_t length)
+{
+	hal_stream = hal_request->beginResponseStream(content_type);
+	hal_stream->setCode(code);
+
+	addPendingHeaders(hal_stream);
+}
+
+void halHttpSendContent(const char *data, size_t length)
+{
+	hal_stream->write((const uint8_t*)data, length);
+}
+
+void halHttpEndContent()
+{
+	hal_request->send(hal_stream);
+	hal_stream = NULL;
+}
+
+void halHttpSendFill(int code, const char *content_type, HalHttpFill fill, void *context, void (*done)(void *context))
+{
+	AsyncWebServerResponse *response = hal_request->beginChunkedResponse(content_type, [fill, context](uint8_t *buffer, size_t max_length, size_t index)
+	{
+		return fill(context, (char*)buffer, max_length);
+	});
+
+	response->setCode(code);
+	addPendingHeaders(response);
+
+	// called once when the connection is closed, after the response or when the client went away
+	hal_request->onDisconnect([done, context]()
+	{
+		done(context);
+	});
+
+	hal_request->send(response);
+}
+
+void halHttpSendStatic(int code, const char *content_type, const uint8_t *gzip_data, size_t length)
+{
+	AsyncWebServerResponse *response = hal_request->beginResponse_P(code, content_type, gzip_data, length);
+
+	response->addHeader("Content-Encoding", "gzip");
+	addPendingHeaders(response);
+	hal_request->send(response);
+}
+
+void halUdpBegin(uint16_t port)
+{
+	halUdp.begin(port);
+}
+
+bool halUdpSend(const uint8_t address[4], uint16_t port, const char *data, size_t length)
+{
+	if(!halUdp.beginPacket(IPAddress(address[0], address[1], address[2], address[3]), port))
+		return false;
+
+	halUdp.write(data, length);
+
+	return halUdp.endPacket();
+}
+
+void halPostFinish(int result)
+{
+	if(!hal_post_running)
+		return;
+
+	hal_post_running = false;
+	hal_post_result = result;
+}
+
+// hands as much of the request to the TCP stack as its send buffer takes, the rest follows with the acks
+void halPostSend()
+{
+	size_t header_length = hal_post_header.length();
+	size_t total = header_length + hal_post_length;
+
+	while(hal_post_sent < total)
+	{
+		size_t space = hal_post_client.space();
+
+		if(!space)
+			break;
+
+		const char *data = (hal_post_sent < header_length) ? hal_post_header.c_str() + hal_post_sent : hal_post_body + (hal_post_sent - header_length);
+		size_t remaining = (hal_post_sent < header_length) ? header_length - hal_post_sent : total - hal_post_sent;
+		size_t added = hal_post_client.add(data, min(space, remaining));
+
+		if(!added)
+			break;
+
+		hal_post_sent += added;
+	}
+
+	hal_post_client.send();
+}
+
+void halPostReceive(const char *data, size_t length)
+{
+	while(length-- && (hal_post_status_length < HAL_POST_STATUS_LENGTH))
+		hal_post_status[hal_post_status_length++] = *data++;
+
+	if(hal_post_status_length < HAL_POST_STATUS_LENGTH)
+		return;
+
+	hal_post_status[HAL_POST_STATUS_LENGTH] = 0;
+	halPostFinish(atoi(hal_post_status + 9));
+
+	// closed once the callback has returned
+	hal_post_client.close();
+}
+
+bool halHttpPostBegin(const char *host, uint16_t port, const char *path, const char *content_type, const char *body, size_t length)
+{
+	if(hal_post_running)
+		return false;
+
+	hal_post_header = String("POST ") + path + " HTTP/1.1\r\nHost: " + host + ':' + port + "\r\nContent-Type: " + content_type +
+		"\r\nContent-Length: " + length + "\r\nConnection: close\r\n\r\n";
+	hal_post_body = body;
+	hal_post_length = length;
+	hal_post_sent = 0;
+	hal_post_status_length = 0;
+	hal_post_start_ms = millis();
+	hal_post_running = true;
+
+	hal_post_client.onConnect([](void *arg, AsyncClient *client) { halPostSend(); });
+	hal_post_client.onAck([](void *arg, AsyncClient *client, size_t length, uint32_t time) { halPostSend(); });
+	hal_post_client.onData([](void *arg, AsyncClient *client, void *data, size_t length) { halPostReceive((const char*)data, length); });
+	hal_post_client.onError([](void *arg, AsyncClient *client, err_t error) { halPostFinish(-1); });
+	hal_post_client.onDisconnect([](void *arg, AsyncClient *client) { halPostFinish(-1); });
+
+	// the host name is resolved in the background as well
+	if(!hal_post_client.connect(host, port))
+		halPostFinish(-1);
+
+	return true;
+}
+
+int halHttpPostResult()
+{
+	if(hal_post_running && (millis() - hal_post_start_ms > HAL_HTTP_POST_TIMEOUT_MS))
+	{
+		halPostFinish(-1);
+		hal_post_client.abort();
+	}
+
+	return hal_post_running ? HAL_HTTP_POST_PENDING : hal_post_result;
+}
+
+void halTcpReceive(const uint8_t *data, size_t length)
+{
+	if(hal_tcp_rx_count + length > HAL_TCP_RX_LENGTH)
+	{
+		hal_tcp_overflow = true;
+		// closed once the callback has returned
+		hal_tcp.close();
+		return;
+	}
+
+	for(size_t i = 0; i < length; i++)
+		hal_tcp_rx[(hal_tcp_rx_first + hal_tcp_rx_count++) % HAL_TCP_RX_LENGTH] = data[i];
+}
+
+bool halTcpConnect(const char *host, uint16_t port)
+{
+	halTcpClose();
+
+	hal_tcp_overflow = false;
+	hal_tcp_rx_first = 0;
+	hal_tcp_rx_count = 0;
+
+	hal_tcp.onConnect([](void *arg, AsyncClient *client)
+	{
+		hal_tcp_connecting = false;
+		// the callers collect their packets and write them in one piece
+		client->setNoDelay(true);
+	});
+	hal_tcp.onError([](void *arg, AsyncClient *client, err_t error) { hal_tcp_connecting = false; });
+	hal_tcp.onDisconnect([](void *arg, AsyncClient *client) { hal_tcp_connecting = false; });
+	hal_tcp.onData([](void *arg, AsyncClient *client, void *data, size_t length) { halTcpReceive((const uint8_t*)data, length); });
+
+	hal_tcp_connecting = hal_tcp.connect(host, port);
+
+	return hal_tcp_connecting;
+}
+
+bool halTcpConnecting()
+{
+	return hal_tcp_connecting;
+}
+
+bool halTcpConnected()
+{
+	return hal_tcp.connected() && (!hal_tcp_overflow);
+}
+
+size_t halTcpWrite(const uint8_t *data, size_t length)
+{
+	if(!halTcpConnected())
+		return 0;
+
+	size_t accepted = min(length, hal_tcp.space());
+
+	if(!accepted)
+		return 0;
+
+	accepted = hal_tcp.add((const char*)data, accepted);
+	hal_tcp.send();
+
+	return accepted;
+}
+
+size_t halTcpRead(uint8_t *data, size_t length)
+{
+	size_t count = min(length, (size_t)hal_tcp_rx_count);
+
+	for(size_t i = 0; i < count; i++)
+		data[i] = hal_tcp_rx[(hal_tcp_rx_first + i) % HAL_TCP_RX_LENGTH];
+
+	hal_tcp_rx_first = (hal_tcp_rx_first + count) % HAL_TCP_RX_LENGTH;
+	hal_tcp_rx_count -= count;
+
+	return count;
+}
+
+void halTcpClose()
+{
+	hal_tcp_connecting = false;
+	hal_tcp.close(true);
+}
+
+void halTimeBegin()
+{
+	configTime(0, 0, NTP_SERVER);
+}
+
+uint32_t halEpochSeconds()
+{
+	time_t now = time(nullptr);
+
+	return (now >= EPOCH_VALID_MIN) ? now : 0;
+}
@@ -0,0 +1,105 @@
+#include "Arduino.h"
+#include "hal.h"
+#include "harmonics.h"
+#include "ATM90E36.h"
+#include "globals.h"
+#include "metrics.h"
+#include "response.h"
+
+enum HarmonicsState
+{
+	HARMONICS_IDLE = 0,
+	HARMONICS_ANALYSIS = 1,
+	HARMONICS_READING = 2
+};
+
+// first ratio register of every channel
+const uint16_t harmonics_registers[HARMONICS_CHANNELS] = {AV_HR2, BV_HR2, CV_HR2, AI_HR2, BI_HR2, CI_HR2};
+
+// harmonic ratios of the last complete analysis (0.01 %), index = order - 2, followed by the THD (0.01 %)
+uint16_t harmonics_values[HARMONICS_CHANNELS][HARMONIC_REGISTERS];
+bool harmonics_valid = false;
+
+enum HarmonicsState harmonics_state = HARMONICS_IDLE;
+unsigned long harmonics_last_start = 0;
+uint8_t harmonics_channel = 0;
+
+void initHarmonics()
+{
+	harmonics_valid = false;
+	harmonics_state = HARMONICS_IDLE;
+	harmonics_last_start = halMillis() - HARMONICS_INTERVAL_MS;
+}
+
+void handleHarmonics()
+{
+	unsigned long now = halMillis();
+
+	switch(harmonics_state)
+	{
+		case HARMONICS_IDLE:
+			if((now - harmonics_last_start) < HARMONICS_INTERVAL_MS)
+				return;
+
+			harmonics_last_start = now;
+			writeATM90E36(DFT_CTRL, 0x0001);
+			harmonics_state = HARMONICS_ANALYSIS;
+			return;
+
+		case HARMONICS_ANALYSIS:
+			if(readATM90E36(DFT_CTRL) & 0x0001)
+			{
+				if((now - harmonics_last_start) > HARMONICS_TIMEOUT_MS)
+					harmonics_state = HARMONICS_IDLE;
+
+				return;
+			}
+
+			harmonics_channel = 0;
+			harmonics_state = HARMONICS_READING;
+			return;
+
+		case HARMONICS_READING:
+			// one channel (32 registers) per call keeps the SPI time per loop() iteration close to a sample slice
+			readATM90E36Block(harmonics_registers[harmonics_channel], harmonics_values[harmonics_channel], HARMONIC_REGISTERS);
+
+			if(++harmonics_channel >= HARMONICS_CHANNELS)
+			{
+				harmonics_valid = true;
+				harmonics_state = HARMONICS_IDLE;
+			}
+			return;
+	}
+}
+
+bool writeHarmonicsLine(uint16_t line)
+{
+	if((!harmonics_valid) || (line >= HARMONICS_CHANNELS * HARMONIC_REGISTERS))
+		return false;
+
+	uint8_t channel = line / HARMONIC_REGISTERS;
+	uint8_t index = line % HARMONIC_REGISTERS;
+
+	writePreamble();
+
+	if(index < HARMONIC_ORDERS)
+	{
+		responseWrite((channel < 3) ? "harmonic_voltage" : "harmonic_current");
+		responseWrite(",phase=");
+		responseWrite("ABC"[channel % 3]);
+		responseWrite(",order=");
+		responseWriteInteger(index + 2);
+	}
+	else
+	{
+		responseWrite((channel < 3) ? "thd_voltage" : "thd_current");
+		responseWrite(",phase=");
+		responseWrite("ABC"[channel % 3]);
+	}
+
+	responseWrite(" value=");
+	responseWriteFixed(harmonics_values[channel][index], 100, 2);
+	responseWrite('\n');
+
+	return true;
+}
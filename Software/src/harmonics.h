@@ -0,0 +1,24 @@
+#ifndef HARMONICS_h
+#define HARMONICS_h
+
+// per-harmonic spectrum of every voltage and current channel, from the DFT engine of the ATM90E36
+void initHarmonics();
+// starts an analysis every HARMONICS_INTERVAL_MS and reads the results one channel per call, call from loop()
+void handleHarmonics();
+// one line of the harmonic metric families (harmonic_voltage / harmonic_current with an order tag, thd_voltage /
+// thd_current) through the response writer (see response.h), returns false if there is no such line
+bool writeHarmonicsLine(uint16_t line);
+
+#define HARMONICS_INTERVAL_MS 5000
+// give up on an analysis that did not finish within this time
+#define HARMONICS_TIMEOUT_MS 1000
+// channels: voltage A - C, current A - C
+#define HARMONICS_CHANNELS 6
+// orders 2 - 32, the ratio registers are followed by the THD of the channel
+#define HARMONIC_ORDER_MAX 32
+#define HARMONIC_ORDERS (HARMONIC_ORDER_MAX - 1)
+#define HARMONIC_REGISTERS (HARMONIC_ORDERS + 1)
+
+extern bool harmonics_valid;
+
+#endif
@@ -0,0 +1,110 @@
+#include "Arduino.h"
+#include "hal.h"
+#include "histogram.h"
+#include "response.h"
+#include "metrics.h"
+
+// durations from 100 us up to the multi-hundred-millisecond stalls
+const uint32_t histogram_duration_bounds[HISTOGRAM_BOUNDS] = {100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000};
+// sample intervals, fine around the nominal 500 ms
+const uint32_t histogram_interval_bounds[HISTOGRAM_BOUNDS] = {100000, 250000, 400000, 450000, 490000, 499000, 501000, 510000, 550000, 600000, 1000000, 2000000};
+
+struct Histogram histogram_loop = {"loop_duration_us", histogram_duration_bounds};
+struct Histogram histogram_http = {"http_handler_us", histogram_duration_bounds};
+struct Histogram histogram_spi = {"spi_read_us", histogram_duration_bounds};
+struct Histogram histogram_tick = {"sample_interval_us", histogram_interval_bounds};
+
+struct Histogram *const histograms[] = {&histogram_loop, &histogram_http, &histogram_spi, &histogram_tick};
+#define HISTOGRAM_COUNT (sizeof(histograms) / sizeof(histograms[0]))
+
+unsigned long histogram_window_start_ms = 0;
+
+void histogramAdd(struct Histogram &histogram, uint32_t value)
+{
+	uint8_t bucket = 0;
+
+	while((bucket < HISTOGRAM_BOUNDS) && (value > histogram.bounds[bucket]))
+		bucket++;
+
+	histogram.counts[bucket]++;
+	histogram.count++;
+	histogram.sum += value;
+	histogram.max = max(histogram.max, value);
+}
+
+void histogramResetAll()
+{
+	for(uint8_t i = 0; i < HISTOGRAM_COUNT; i++)
+	{
+		struct Histogram &histogram = *histograms[i];
+
+		memset(histogram.counts, 0, sizeof(histogram.counts));
+		histogram.count = 0;
+		histogram.sum = 0;
+		histogram.max = 0;
+	}
+
+	histogram_window_start_ms = halMillis();
+}
+
+uint32_t histogramWindowSeconds()
+{
+	return (halMillis() - histogram_window_start_ms) / 1000;
+}
+
+void writeHistogramValue(const char *name, const char *suffix, uint64_t value)
+{
+	writePreamble();
+	responseWrite(name);
+	responseWrite(suffix);
+	responseWrite(" value=");
+	responseWriteInteger(value);
+	responseWrite('\n');
+}
+
+// every histogram has its buckets, +Inf, _sum, _count and _max, the window follows the last histogram
+#define HISTOGRAM_LINES (HISTOGRAM_BOUNDS + 4)
+
+bool writeHistogramLine(uint16_t line)
+{
+	if(line == HISTOGRAM_COUNT * HISTOGRAM_LINES)
+	{
+		writeHistogramValue("histogram_window_s", "", histogramWindowSeconds());
+		return true;
+	}
+
+	if(line > HISTOGRAM_COUNT * HISTOGRAM_LINES)
+		return false;
+
+	const struct Histogram &histogram = *histograms[line / HISTOGRAM_LINES];
+	uint8_t bucket = line % HISTOGRAM_LINES;
+
+	if(bucket == HISTOGRAM_BOUNDS + 1)
+		writeHistogramValue(histogram.name, "_sum", histogram.sum);
+	else if(bucket == HISTOGRAM_BOUNDS + 2)
+		writeHistogramValue(histogram.name, "_count", histogram.count);
+	else if(bucket == HISTOGRAM_BOUNDS + 3)
+		writeHistogramValue(histogram.name, "_max", histogram.max);
+	else
+	{
+		uint32_t cumulative = 0;
+
+		for(uint8_t i = 0; i <= bucket; i++)
+			cumulative += histogram.counts[i];
+
+		writePreamble();
+		responseWrite(histogram.name);
+		responseWrite("_bucket,le=");
+
+		if(bucket < HISTOGRAM_BOUNDS)
+			responseWriteInteger(histogram.bounds[bucket]);
+		else
+			responseWrite("+Inf");
+
+		responseWrite(" value=");
+		responseWriteInteger(cumulative);
+		responseWrite('\n');
+	}
+
+	return true;
+}
@@ -0,0 +1,38 @@
+#ifndef HISTOGRAM_h
+#define HISTOGRAM_h
+
+#include <stdint.h>
+
+// fixed-bucket histograms of durations (microseconds), reported on /status like Prometheus histograms:
+// cumulative <name>_bucket series with an le tag, <name>_sum and <name>_count. all histograms cover the same
+// window, from the last histogramResetAll() (/status?reset_histograms=1) or boot until now
+
+// upper bucket bounds without +Inf
+#define HISTOGRAM_BOUNDS 12
+
+struct Histogram
+{
+	const char *name;
+	const uint32_t *bounds;
+	// values per bucket (not cumulative), the last one is +Inf
+	uint32_t counts[HISTOGRAM_BOUNDS + 1];
+	uint32_t count;
+	uint64_t sum;
+	uint32_t max;
+};
+
+void histogramAdd(struct Histogram &histogram, uint32_t value);
+void histogramResetAll();
+// seconds since the last reset
+uint32_t histogramWindowSeconds();
+// one /status line of the histograms through the response writer, returns false if there is no such line
+bool writeHistogramLine(uint16_t line);
+
+// duration of loop(), of an HTTP request handler, of reading the registers of one sample (all slices)
+// and interval between two samples of the normal tier
+extern struct Histogram histogram_loop;
+extern struct Histogram histogram_http;
+extern struct Histogram histogram_spi;
+extern struct Histogram histogram_tick;
+
+#endif
@@ -0,0 +1,227 @@
+#include "Arduino.h"
+#include "hal.h"
+#include "history.h"
+#include "fram.h"
+#include "settings.h"
+#include "rollup.h"
+#include "metrics.h"
+#include "globals.h"
+#include "response.h"
+
+static_assert(sizeof(struct HistoryRecord) % sizeof(int64_t) == 0, "history records must fill whole FRAM blocks");
+static_assert(sizeof(struct HistoryHeader) == 2 * sizeof(int64_t), "history header must fill two FRAM blocks");
+
+struct HistoryHeader history_header;
+
+// interval that is currently being aggregated
+uint32_t history_interval_start = 0;
+int64_t history_energy_start[4];
+int32_t history_power_sum[3];
+uint16_t history_voltage_min[3];
+uint16_t history_voltage_max[3];
+uint16_t history_samples = 0;
+
+uint16_t historyChecksum(const struct HistoryRecord &record)
+{
+	const uint8_t *data = (const uint8_t*)&record;
+	uint16_t sum = 0;
+
+	for(uint8_t i = 0; i < offsetof(struct HistoryRecord, checksum); i++)
+		sum = (sum << 1 | sum >> 15) + data[i];
+
+	return sum;
+}
+
+uint16_t historyAddress(uint32_t sequence)
+{
+	return FRAM_HISTORY_START + (sequence % HISTORY_CAPACITY) * HISTORY_RECORD_BLOCKS;
+}
+
+uint16_t historyBoot()
+{
+	return history_header.boot;
+}
+
+void startInterval()
+{
+	history_interval_start = rollupSeconds();
+	history_samples = 0;
+
+	for(uint8_t i = 0; i < 4; i++)
+		history_energy_start[i] = setting_energy_total[i];
+}
+
+void initHistory()
+{
+	readFram((uint8_t*)&history_header, FRAM_HISTORY_HEADER, sizeof(history_header));
+
+	// a log written with a larger capacity keeps its records that still match their slot (checked when reading)
+	if(history_header.count > HISTORY_CAPACITY)
+		history_header.count = HISTORY_CAPACITY;
+
+	if(history_header.magic != HISTORY_MAGIC)
+	{
+		history_header.magic = HISTORY_MAGIC;
+		history_header.boot = 0;
+		history_header.next_sequence = 0;
+		history_header.count = 0;
+		history_header.reserved = 0;
+	}
+
+	history_header.boot++;
+	writeFram((uint8_t*)&history_header, FRAM_HISTORY_HEADER, sizeof(history_header));
+
+	startInterval();
+}
+
+void appendRecord(uint32_t now)
+{
+	struct HistoryRecord record;
+
+	record.sequence = history_header.next_sequence;
+	record.uptime_s = now;
+	record.boot = history_header.boot;
+	record.duration_s = now - history_interval_start;
+
+	for(uint8_t i = 0; i < 4; i++)
+		record.energy[i] = setting_energy_total[i] - history_energy_start[i];
+
+	for(uint8_t phase = 0; phase < 3; phase++)
+	{
+		record.power[phase] = history_power_sum[phase] / history_samples;
+		record.voltage_min[phase] = history_voltage_min[phase];
+		record.voltage_max[phase] = history_voltage_max[phase];
+	}
+
+	record.checksum = historyChecksum(record);
+
+	// the record is written before the header, a reset in between only loses this record
+	writeFram((uint8_t*)&record, historyAddress(record.sequence), sizeof(record));
+
+	history_header.next_sequence++;
+	if(history_header.count < HISTORY_CAPACITY)
+		history_header.count++;
+
+	writeFram((uint8_t*)&history_header, FRAM_HISTORY_HEADER, sizeof(history_header));
+}
+
+void historySample(const int16_t power[3], const uint16_t voltage[3])
+{
+	uint32_t now = rollupSeconds();
+
+	if((now - history_interval_start) >= HISTORY_INTERVAL_S)
+	{
+		if(history_samples)
+			appendRecord(now);
+
+		startInterval();
+	}
+
+	for(uint8_t phase = 0; phase < 3; phase++)
+	{
+		if(!history_samples)
+		{
+			history_power_sum[phase] = 0;
+			history_voltage_min[phase] = voltage[phase];
+			history_voltage_max[phase] = voltage[phase];
+		}
+
+		history_power_sum[phase] += power[phase];
+		history_voltage_min[phase] = min(history_voltage_min[phase], voltage[phase]);
+		history_voltage_max[phase] = max(history_voltage_max[phase], voltage[phase]);
+	}
+
+	history_samples++;
+}
+
+// part 0 is the header, then one record per part. cursor.from: sequence of the next record, cursor.to: last one
+bool renderHistory(struct ResponseCursor &cursor)
+{
+	if(!cursor.part)
+	{
+		responseWrite("# next_sequence=");
+		responseWriteInteger(history_header.next_sequence);
+		responseWrite(" boot=");
+		responseWriteInteger(history_header.boot);
+		responseWrite(" uptime_s=");
+		responseWriteInteger(rollupSeconds());
+		responseWrite('\n');
+		return true;
+	}
+
+	if(cursor.from > cursor.to)
+		return false;
+
+	int64_t sequence = cursor.from++;
+	const char *phases = "TABC";
+
+	// records that have been overwritten meanwhile are skipped
+	struct HistoryRecord record;
+	readFram((uint8_t*)&record, historyAddress(sequence), sizeof(record));
+
+	if((record.sequence != sequence) || (record.checksum != historyChecksum(record)))
+		return true;
+
+	writePreamble();
+	responseWrite("history sequence=");
+	responseWriteInteger(record.sequence);
+	responseWrite("i,boot=");
+	responseWriteInteger(record.boot);
+	responseWrite("i,uptime_s=");
+	responseWriteInteger(record.uptime_s);
+	responseWrite("i,duration_s=");
+	responseWriteInteger(record.duration_s);
+	responseWrite('i');
+
+	for(uint8_t i = 0; i < 4; i++)
+	{
+		responseWrite(",energy_");
+		responseWrite(phases[i]);
+		responseWrite('=');
+		responseWriteFixed(record.energy[i], 10000, 4);
+	}
+
+	for(uint8_t phase = 0; phase < 3; phase++)
+	{
+		responseWrite(",power_");
+		responseWrite(phases[phase + 1]);
+		responseWrite('=');
+		responseWriteInteger(record.power[phase]);
+
+		responseWrite(",voltage_min_");
+		responseWrite(phases[phase + 1]);
+		responseWrite('=');
+		responseWriteFixed(record.voltage_min[phase], 100, 2);
+
+		responseWrite(",voltage_max_");
+		responseWrite(phases[phase + 1]);
+		responseWrite('=');
+		responseWriteFixed(record.voltage_max[phase], 100, 2);
+	}
+
+	responseWrite('\n');
+
+	return true;
+}
+
+void handleHistory()
+{
+	uint32_t first = history_header.next_sequence - history_header.count;
+	struct ResponseCursor cursor = {};
+
+	cursor.from = first;
+	cursor.to = (int64_t)history_header.next_sequence - 1;
+
+	if((halHttpHasArg("from") && !parse_int64(cursor.from, halHttpArg("from").c_str())) ||
+		(halHttpHasArg("to") && !parse_int64(cursor.to, halHttpArg("to").c_str())))
+	{
+		halHttpSend(400, "text/plain", "from and to must be sequence numbers");
+		return;
+	}
+
+	// only the requested records are read from FRAM
+	cursor.from = max(cursor.from, (int64_t)first);
+	cursor.to = min(cursor.to, (int64_t)history_header.next_sequence - 1);
+
+	responseSendParts(200, "text/plain; version=0.0.4", renderHistory, cursor);
+}
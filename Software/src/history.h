@@ -0,0 +1,51 @@
+#ifndef HISTORY_h
+#define HISTORY_h
+
+// circular log of aggregated intervals in the FRAM region FRAM_HISTORY_START - FRAM_HISTORY_END.
+// records are numbered with a sequence that continues across reboots, record n is stored at slot
+// n % HISTORY_CAPACITY, so a range of sequence numbers maps directly to FRAM addresses
+
+void initHistory();
+// account one sample of the mean power (W) and the rms voltage (0.01 V) of every phase,
+// appends a record when the interval has ended
+void historySample(const int16_t power[3], const uint16_t voltage[3]);
+// boot counter, increased by initHistory()
+uint16_t historyBoot();
+// records as text, args: from / to (sequence numbers)
+void handleHistory();
+
+#define HISTORY_INTERVAL_S 900
+
+#define HISTORY_MAGIC 0x4854
+
+struct HistoryRecord
+{
+	uint32_t sequence;
+	// uptime at the end of the interval, boot counter and length of the interval
+	uint32_t uptime_s;
+	uint16_t boot;
+	uint16_t duration_s;
+	// energy imported - exported during the interval (0.1 Wh), total and phase A - C
+	int32_t energy[4];
+	// mean active power (W) and rms voltage range (0.01 V) of phase A - C
+	int16_t power[3];
+	uint16_t voltage_min[3];
+	uint16_t voltage_max[3];
+	uint16_t checksum;
+};
+
+// 48 bytes = 6 FRAM blocks
+#define HISTORY_RECORD_BLOCKS (sizeof(struct HistoryRecord) / sizeof(int64_t))
+#define HISTORY_CAPACITY ((FRAM_HISTORY_END - FRAM_HISTORY_START) / HISTORY_RECORD_BLOCKS)
+
+struct HistoryHeader
+{
+	uint16_t magic;
+	uint16_t boot;
+	// sequence number of the next record and number of records in the log
+	uint32_t next_sequence;
+	uint32_t count;
+	uint32_t reserved;
+};
+
+#endif
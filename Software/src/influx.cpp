@@ -0,0 +1,276 @@
+#include "Arduino.h"
+#include "hal.h"
+#include "fram.h"
+#include "influx.h"
+#include "metrics.h"
+#include "settings.h"
+#include "history.h"
+#include "rollup.h"
+
+static_assert(sizeof(struct InfluxRecord) % sizeof(int64_t) == 0, "influx records must fill whole FRAM blocks");
+static_assert(sizeof(struct InfluxSpoolHeader) == 2 * sizeof(int64_t), "influx spool header must fill two FRAM blocks");
+
+// RAM part of the queue, newer than every record in the spool
+struct InfluxRecord influx_ram[INFLUX_RAM_RECORDS];
+uint8_t influx_ram_first = 0;
+uint8_t influx_ram_count = 0;
+
+struct InfluxSpoolHeader influx_spool;
+
+bool influx_enabled = false;
+// uptime of the next record
+uint32_t influx_next_record_s = 0;
+// earliest time of the next POST and backoff after the last failed one (0 = last POST succeeded)
+unsigned long influx_next_post_ms = 0;
+unsigned long influx_backoff_ms = 0;
+
+// body of the POST, separate from message_buffer because request handlers may run while the POST is waiting
+String influx_body;
+
+// batch of the running POST: records taken from the head of the spool or of the RAM queue, all of them are in the body.
+// records of the batch can leave their queue before the result is known: a full RAM queue moves them to the (then
+// empty) spool and a full spool discards its head, both are counted in moved
+bool influx_post_running = false;
+bool influx_post_from_spool = false;
+uint8_t influx_post_taken = 0;
+uint8_t influx_post_moved = 0;
+
+uint32_t influx_records_sent = 0;
+uint32_t influx_records_dropped = 0;
+uint32_t influx_posts_failed = 0;
+
+uint16_t spoolAddress(uint16_t slot)
+{
+	return FRAM_SPOOL_START + (slot % INFLUX_SPOOL_CAPACITY) * INFLUX_RECORD_BLOCKS;
+}
+
+void writeSpoolHeader()
+{
+	writeFram((uint8_t*)&influx_spool, FRAM_SPOOL_HEADER, sizeof(influx_spool));
+}
+
+// the record is written before the header, a reset in between only loses this record
+void spoolAppend(struct InfluxRecord &record)
+{
+	if(influx_spool.count >= INFLUX_SPOOL_CAPACITY)
+	{
+		influx_spool.first = (influx_spool.first + 1) % INFLUX_SPOOL_CAPACITY;
+		influx_spool.count--;
+		influx_records_dropped++;
+
+		// a discarded record of the running POST is not removed again when the POST succeeds
+		if(influx_post_running && influx_post_from_spool && (influx_post_moved < influx_post_taken))
+			influx_post_moved++;
+	}
+
+	writeFram((uint8_t*)&record, spoolAddress(influx_spool.first + influx_spool.count), sizeof(record));
+
+	influx_spool.count++;
+	writeSpoolHeader();
+}
+
+uint16_t influxQueued()
+{
+	return influx_spool.count + influx_ram_count;
+}
+
+void initInflux()
+{
+	readFram((uint8_t*)&influx_spool, FRAM_SPOOL_HEADER, sizeof(influx_spool));
+
+	if((influx_spool.magic != INFLUX_SPOOL_MAGIC) || (influx_spool.first >= INFLUX_SPOOL_CAPACITY) || (influx_spool.count > INFLUX_SPOOL_CAPACITY))
+	{
+		memset(&influx_spool, 0, sizeof(influx_spool));
+		influx_spool.magic = INFLUX_SPOOL_MAGIC;
+		writeSpoolHeader();
+	}
+
+	halTimeBegin();
+	configureInflux();
+}
+
+void configureInflux()
+{
+	influx_enabled = setting_influx_host[0] != 0;
+	influx_backoff_ms = 0;
+	influx_next_post_ms = halMillis();
+}
+
+void influxSample()
+{
+	uint32_t now = rollupSeconds();
+
+	if((!influx_enabled) || ((int32_t)(now - influx_next_record_s) < 0))
+		return;
+
+	influx_next_record_s = now + setting_influx_interval;
+
+	// a full RAM queue moves its oldest record to the end of the spool, which keeps the order
+	if(influx_ram_count >= INFLUX_RAM_RECORDS)
+	{
+		spoolAppend(influx_ram[influx_ram_first]);
+		influx_ram_first = (influx_ram_first + 1) % INFLUX_RAM_RECORDS;
+		influx_ram_count--;
+
+		if(influx_post_running && (!influx_post_from_spool) && (influx_post_moved < influx_post_taken))
+			influx_post_moved++;
+	}
+
+	struct InfluxRecord &record = influx_ram[(influx_ram_first + influx_ram_count) % INFLUX_RAM_RECORDS];
+	uint32_t epoch = halEpochSeconds();
+
+	captureInfluxRecord(record);
+	record.time = epoch ? epoch : now;
+	record.flags = epoch ? 0 : INFLUX_RECORD_UPTIME;
+	record.boot = historyBoot();
+
+	influx_ram_count++;
+}
+
+// epoch seconds of a record, 0 if it can never be timestamped, -1 while the clock is not synchronized
+int64_t recordEpoch(const struct InfluxRecord &record, uint32_t epoch_now)
+{
+	if(!(record.flags & INFLUX_RECORD_UPTIME))
+		return record.time;
+
+	if(record.boot != historyBoot())
+		return 0;
+
+	if(!epoch_now)
+		return -1;
+
+	return epoch_now - (rollupSeconds() - record.time);
+}
+
+// removes a sent batch from the head of its queue, records that have moved to the spool meanwhile are at its head
+void influxRemove(bool from_spool, uint8_t taken, uint8_t moved)
+{
+	if(from_spool)
+	{
+		influx_spool.first = (influx_spool.first + taken - moved) % INFLUX_SPOOL_CAPACITY;
+		influx_spool.count -= taken - moved;
+		writeSpoolHeader();
+		return;
+	}
+
+	if(moved)
+	{
+		influx_spool.first = (influx_spool.first + moved) % INFLUX_SPOOL_CAPACITY;
+		influx_spool.count -= moved;
+		writeSpoolHeader();
+	}
+
+	influx_ram_first = (influx_ram_first + taken - moved) % INFLUX_RAM_RECORDS;
+	influx_ram_count -= taken - moved;
+}
+
+// the batch stays queued and is retried after the backoff
+void influxPostFailed()
+{
+	influx_posts_failed++;
+	influx_backoff_ms = influx_backoff_ms ? min(2 * influx_backoff_ms, (unsigned long)INFLUX_BACKOFF_MAX_MS) : INFLUX_BACKOFF_MIN_MS;
+	influx_next_post_ms = halMillis() + influx_backoff_ms;
+}
+
+void influxPostFinished(int code)
+{
+	influx_post_running = false;
+
+	// unreachable, server errors and rate limiting are retried, other errors would fail again
+	if((code < 0) || (code >= 500) || (code == 429))
+	{
+		influxPostFailed();
+		return;
+	}
+
+	// records discarded by the full spool were counted as dropped already
+	uint8_t queued = influx_post_from_spool ? influx_post_taken - influx_post_moved : influx_post_taken;
+
+	if((code >= 200) && (code < 300))
+		influx_records_sent += queued;
+	else
+		influx_records_dropped += queued;
+
+	influx_backoff_ms = 0;
+	influx_next_post_ms = halMillis() + INFLUX_POST_SPACING_MS;
+
+	influxRemove(influx_post_from_spool, influx_post_taken, influx_post_moved);
+}
+
+void handleInflux()
+{
+	if(influx_post_running)
+	{
+		int code = halHttpPostResult();
+
+		if(code != HAL_HTTP_POST_PENDING)
+			influxPostFinished(code);
+
+		return;
+	}
+
+	unsigned long now = halMillis();
+
+	if((!influx_enabled) || ((long)(now - influx_next_post_ms) < 0))
+		return;
+
+	// the spool is replayed in batches as soon as possible, new records are only sent once a batch is complete
+	bool from_spool = influx_spool.count > 0;
+	uint16_t available = from_spool ? influx_spool.count : influx_ram_count;
+
+	if((!from_spool) && (available < setting_influx_batch))
+		return;
+
+	available = min(available, (uint16_t)setting_influx_batch);
+
+	uint32_t epoch_now = halEpochSeconds();
+	uint8_t taken = 0;
+
+	influx_body.remove(0);
+
+	while(taken < available)
+	{
+		struct InfluxRecord spooled;
+		const struct InfluxRecord *record = &spooled;
+
+		if(from_spool)
+			readFram((uint8_t*)&spooled, spoolAddress(influx_spool.first + taken), sizeof(spooled));
+		else
+			record = &influx_ram[(influx_ram_first + taken) % INFLUX_RAM_RECORDS];
+
+		int64_t epoch = recordEpoch(*record, epoch_now);
+
+		// keep the order, wait for the clock before sending anything after this record
+		if(epoch < 0)
+			break;
+
+		// a record that can never be timestamped is discarded once it is at the head of its queue
+		if(!epoch)
+		{
+			if(taken)
+				break;
+
+			influxRemove(from_spool, 1, 0);
+			influx_records_dropped++;
+			available--;
+			continue;
+		}
+
+		appendInfluxLines(influx_body, *record, epoch);
+		taken++;
+	}
+
+	if(!taken)
+		return;
+
+	if(!halHttpPostBegin(setting_influx_host, setting_influx_port, setting_influx_path, "text/plain", influx_body.c_str(), influx_body.length()))
+	{
+		influxPostFailed();
+		return;
+	}
+
+	influx_post_running = true;
+	influx_post_from_spool = from_spool;
+	influx_post_taken = taken;
+	influx_post_moved = 0;
+}
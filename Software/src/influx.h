@@ -0,0 +1,70 @@
+#ifndef INFLUX_h
+#define INFLUX_h
+
+#include <stdint.h>
+
+// timestamped push to an InfluxDB HTTP endpoint (line protocol, /write API). every setting_influx_interval seconds
+// a record of the main page averages and the energy totals is queued, setting_influx_batch records are sent in one POST.
+// the queue holds INFLUX_RAM_RECORDS records in RAM, older records that could not be delivered yet move to the FRAM
+// region FRAM_SPOOL_START - FRAM_SPOOL_END (the oldest one is dropped when that is full as well). records are always
+// sent oldest first, failed POSTs are retried with exponential backoff. one POST runs at a time in the background.
+// records are stamped with the SNTP time. records taken before the clock was synchronized carry their uptime and
+// boot number and are converted once the time is known (records of an earlier boot are dropped then)
+
+void initInflux();
+// parses the influx settings and retries right away
+void configureInflux();
+// queues a record when the interval has ended, called with every complete sample of the normal tier
+void influxSample();
+// starts the next POST when it is due and collects the result of the running one, call from loop()
+void handleInflux();
+
+// main page values (voltage, current, power, frequency) per record
+#define INFLUX_VALUES_MAX 12
+// records per POST and records kept in RAM
+#define INFLUX_BATCH_MAX 6
+#define INFLUX_RAM_RECORDS INFLUX_BATCH_MAX
+
+// time between two POSTs while the queue is replayed and limits of the backoff after a failed POST
+#define INFLUX_POST_SPACING_MS 1000
+#define INFLUX_BACKOFF_MIN_MS 5000
+#define INFLUX_BACKOFF_MAX_MS 300000
+
+// record time is seconds since boot (historyBoot() number), not epoch seconds
+#define INFLUX_RECORD_UPTIME (1 << 0)
+
+struct InfluxRecord
+{
+	uint32_t time;
+	uint16_t boot;
+	uint8_t flags;
+	uint8_t value_count;
+	// raw averages of the main page values (order of metrics[]) and energy totals (0.1 Wh) of T, A - C
+	int32_t values[INFLUX_VALUES_MAX];
+	int64_t energy[4];
+};
+
+// 88 bytes = 11 FRAM blocks
+#define INFLUX_RECORD_BLOCKS (sizeof(struct InfluxRecord) / sizeof(int64_t))
+#define INFLUX_SPOOL_CAPACITY ((FRAM_SPOOL_END - FRAM_SPOOL_START) / INFLUX_RECORD_BLOCKS)
+
+#define INFLUX_SPOOL_MAGIC 0x4953
+
+struct InfluxSpoolHeader
+{
+	uint16_t magic;
+	// slot of the oldest record and number of records in the spool
+	uint16_t first;
+	uint16_t count;
+	uint16_t reserved[5];
+};
+
+extern uint32_t influx_records_sent;
+// records lost because the spool was full, the server rejected them or they could not be timestamped
+extern uint32_t influx_records_dropped;
+extern uint32_t influx_posts_failed;
+
+// records waiting in RAM and FRAM
+uint16_t influxQueued();
+
+#endif
@@ -1,8 +1,15 @@
 #include "Arduino.h"
 #include <ESP8266WiFi.h>
-#include <SPI.h>
 
+#include "hal.h"
 #include "metrics.h"
+#include "sampler.h"
+#include "capture.h"
+#include "harmonics.h"
+#include "history.h"
+#include "influx.h"
+#include "mqtt.h"
+#include "histogram.h"
 #include "ATM90E36.h"
 #include "fram.h"
 #include "web.h"
@@ -25,11 +32,14 @@ void setup(void)
 
 	Serial.println("\n\nBooting Sketch...");
 
-	SPI.begin();
 	initFRAM();
 	initSettings();
 	initMetrics();
+	initHistory();
+	initInflux();
 	initATM90E36();
+	initSampling();
+	initHarmonics();
 
 	Serial.println("Initializing WiFi");
 
@@ -62,48 +72,42 @@ void setup(void)
 
 	WiFi.hostname(setting_wifi_hostname);
 
+	histogramResetAll();
 	initWeb();
-
-	// pushClient.setTimeout(500);
+	configureMqtt();
 
 	Serial.println("setup finished");
 }
 
 void loop(void)
 {
-	static unsigned long last_spi_read_time = millis();
 	static unsigned long last_uptime_update = millis();
-	static unsigned long last_pushClient_attempt = 0;
 
 	unsigned long loop_start = micros();
 
-	httpServer.handleClient();
+	halHttpHandle();
+	handleSettings();
 
 	unsigned long now = millis();
 
-	if((now - last_spi_read_time) > SAMPLE_INTERVAL_MS)
-	{
-		last_spi_read_time += SAMPLE_INTERVAL_MS;
+	handleSampling();
+	handleMetricsCommit();
+	handleCapture();
+	handleHarmonics();
+	handleInflux();
+	handleMqtt();
+	handleMetricsMqtt();
 
-		readMetrics();
-	}
+	// whole seconds since the last update, a stall adds them at once
+	unsigned long uptime_elapsed = (now - last_uptime_update) / 1000;
 
-	if((now - last_uptime_update) > 1000)
-	{
-		uptime_seconds++;
-		last_uptime_update += 1000;
-	}
-
-	// if ((!pushClient.connected()) && ((now - last_pushClient_attempt) > 10000)) {
-	// 	if(pushClient.connect(IPAddress(192, 168, 2, 91), 8001))
-	// 	{
-	// 		startMetricSocket();
-	// 	}
-	// 	last_pushClient_attempt = now;
-	// }
+	uptime_seconds += uptime_elapsed;
+	last_uptime_update += uptime_elapsed * 1000;
 
 	unsigned long loop_duration_ul = micros() - loop_start;
 
+	histogramAdd(histogram_loop, loop_duration_ul);
+
 	loop_duration = 0.99 * loop_duration + 0.01 * loop_duration_ul;
 	loop_duration_max = max(loop_duration_max, (double)loop_duration_ul);
 }
@@ -1,124 +1,260 @@
+#include <climits>
+
 #include "Arduino.h"
-#include <WiFiUdp.h>
+#include "hal.h"
 #include "ATM90E36.h"
 #include "metrics.h"
 #include "fram.h"
 #include "settings.h"
-#include "web.h"
 #include "globals.h"
+#include "readplan.h"
+#include "harmonics.h"
+#include "rollup.h"
+#include "history.h"
+#include "format.h"
+#include "response.h"
+#include "binary.h"
+#include "push.h"
+#include "influx.h"
+#include "mqtt.h"
+#include "histogram.h"
 
-enum ValueType {LSB_UNSIGNED = 1, LSB_COMPLEMENT = 2, NOLSB_UNSIGNED = 3, NOLSB_SIGNED = 4};
-
-struct Metric
-{
-	// content of the name tag
-	const char *name;
-	// content for the phase tag, every char makes a new value.
-	// ABC=individual phases, N=neutral (for calculated current and metrics that don't belong to a particular phase),
-	// T=total
-	const char *phases;
-	// address of SPI register
-	unsigned short address;
-	// factor to convert the raw integer value to the proper floating point value
-	// when LSB is used, a factor of 1/256 is added automatically
-	double factor;
-	// wether to use the additional LSB register
-	enum ValueType type;
-	// number of decimal places to show
-	uint8_t decimals;
-	// showInMain = false -> the metric is only shown on /allmetrics
-	bool showInMain;
-	int32_t **values;
-};
-
-struct Metric metrics[] = {
-	{"voltage", "ABC", UrmsA, 1./100, LSB_UNSIGNED, 2, true},
+constexpr struct Metric metrics[] = {
+	{"voltage", "ABC", UrmsA, 1, 100, LSB_UNSIGNED, 2, true, TIER_NORMAL},
 
-	{"current", "T", IrmsN0, 1./1000, NOLSB_UNSIGNED, 3, true},
-	{"current", "ABC", IrmsA, 1./1000, LSB_UNSIGNED, 5, true},
+	{"current", "T", IrmsN0, 1, 1000, NOLSB_UNSIGNED, 3, true, TIER_FAST},
+	{"current", "ABC", IrmsA, 1, 1000, LSB_UNSIGNED, 5, true, TIER_FAST},
 
-	{"power", "T", PmeanT, 4., LSB_COMPLEMENT, 2, true},
-	{"power", "ABC", PmeanA, 1., LSB_COMPLEMENT, 2, true},
+	{"power", "T", PmeanT, 4, 1, LSB_COMPLEMENT, 2, true, TIER_FAST},
+	{"power", "ABC", PmeanA, 1, 1, LSB_COMPLEMENT, 2, true, TIER_FAST},
 
-	{"power_reactive", "T", QmeanT, 4./1000, LSB_COMPLEMENT, 2, false},
-	{"power_reactive", "ABC", QmeanA, 1./1000, LSB_COMPLEMENT, 2, false},
+	{"power_reactive", "T", QmeanT, 4, 1000, LSB_COMPLEMENT, 2, false, TIER_NORMAL},
+	{"power_reactive", "ABC", QmeanA, 1, 1000, LSB_COMPLEMENT, 2, false, TIER_NORMAL},
 
-	{"power_apparent", "T", SmeanT, 4./1000, LSB_COMPLEMENT, 2, false},
-	{"power_apparent", "ABC", SmeanA, 1./1000, LSB_COMPLEMENT, 2, false},
+	{"power_apparent", "T", SmeanT, 4, 1000, LSB_COMPLEMENT, 2, false, TIER_NORMAL},
+	{"power_apparent", "ABC", SmeanA, 1, 1000, LSB_COMPLEMENT, 2, false, TIER_NORMAL},
 
-	{"power_factor", "TABC", PFmeanT, 1./1000, NOLSB_SIGNED, 3, false},
+	{"power_factor", "TABC", PFmeanT, 1, 1000, NOLSB_SIGNED, 3, false, TIER_NORMAL},
 
-	{"phase_angle_voltage", "ABC", UangleA, 1./10, NOLSB_SIGNED, 2, false},
-	{"phase_angle_current", "ABC", PAngleA, 1./10, NOLSB_SIGNED, 2, false},
+	{"phase_angle_voltage", "ABC", UangleA, 1, 10, NOLSB_SIGNED, 2, false, TIER_SLOW},
+	{"phase_angle_current", "ABC", PAngleA, 1, 10, NOLSB_SIGNED, 2, false, TIER_SLOW},
 
-	{"thdn_voltage", "ABC", THDNUA, 1./100, NOLSB_UNSIGNED, 1, false},
-	{"thdn_current", "ABC", THDNIA, 1./100, NOLSB_UNSIGNED, 1, false},
+	{"thdn_voltage", "ABC", THDNUA, 1, 100, NOLSB_UNSIGNED, 1, false, TIER_SLOW},
+	{"thdn_current", "ABC", THDNIA, 1, 100, NOLSB_UNSIGNED, 1, false, TIER_SLOW},
 
-	{"frequency", "T", Freq, 1./100, NOLSB_UNSIGNED, 3, true},
-	{"temperature", "T", Temp, 1., NOLSB_SIGNED, 0, false}
+	{"frequency", "T", Freq, 1, 100, NOLSB_UNSIGNED, 3, true, TIER_NORMAL},
+	{"temperature", "T", Temp, 1, 1, NOLSB_SIGNED, 0, false, TIER_MINUTE}
 };
 #define METRIC_COUNT (sizeof(metrics)/sizeof(metrics[0]))
-//
-// void startMetricSocket()
-// {
-// 	pushClient.println("SERIES name:power loc:main");
-// 	pushClient.print("COLUMNS ");
-//
-// 	for(uint8_t index_metric = 0; index_metric < METRIC_COUNT; index_metric++)
-// 	{
-// 		struct Metric metric = metrics[index_metric];
-//
-// 		if (!metric.showInMain)
-// 			continue;
-//
-// 		uint8_t phasecount = strlen(metric.phases);
-//
-// 		for(uint8_t index_phase = 0; index_phase < phasecount; index_phase++)
-// 		{
-// 			if (index_metric != 0 || index_phase != 0)
-// 				pushClient.print("|");
-// 			pushClient.print("name:");
-// 			pushClient.print(metrics[index_metric].name);
-// 			pushClient.print(" phase:");
-// 			pushClient.print(metrics[index_metric].phases[index_phase]);
-// 		}
-// 	}
-//
-// 	pushClient.print("|name:energy phase:T");
-// 	pushClient.print("|name:energy phase:A");
-// 	pushClient.print("|name:energy phase:B");
-//
-// 	auto len = pushClient.println("|name:energy phase:C");
-//
-// 	if (len == 0)
-// 	{
-// 		pushClient.stop();
-// 	}
-// }
-
-WiFiUDP pushUdp;
-
-void sendMetricsSocket(uint8_t index)
+#define VALUE_COUNT countValues(metrics)
+
+// interval, ring buffer depth and name of every tier. the buffer depth is enough to average over
+// setting_sample_count * SAMPLE_INTERVAL_MS for all tiers faster than that
+constexpr struct SampleTier sample_tiers[TIER_COUNT] = {
+	{100, SAMPLE_COUNT_MAX * SAMPLE_INTERVAL_MS / 100, "fast"},		// TIER_FAST
+	{SAMPLE_INTERVAL_MS, SAMPLE_COUNT_MAX, "normal"},				// TIER_NORMAL
+	{5000, 4, "slow"},												// TIER_SLOW
+	{60000, 1, "minute"}											// TIER_MINUTE
+};
+
+// sample buffer slot of every metric and phase (slot = metric_layout.first_slot[index_metric] + index_phase)
+// and position of its ring buffer in sample_arena
+constexpr auto metric_layout = makeMetricLayout<VALUE_COUNT>(metrics, sample_tiers);
+
+// registers to read and decode steps for every tier, generated from metrics[] at compile time.
+// the energy registers are read with the normal tier
+constexpr ReadPlan<VALUE_COUNT> read_plans[TIER_COUNT] = {
+	makeReadPlan<VALUE_COUNT>(metrics, TIER_FAST, 0, 0),
+	makeReadPlan<VALUE_COUNT>(metrics, TIER_NORMAL, APenergyT, 8),
+	makeReadPlan<VALUE_COUNT>(metrics, TIER_SLOW, 0, 0),
+	makeReadPlan<VALUE_COUNT>(metrics, TIER_MINUTE, 0, 0)
+};
+static_assert(read_plans[TIER_FAST].valid && read_plans[TIER_NORMAL].valid && read_plans[TIER_SLOW].valid && read_plans[TIER_MINUTE].valid,
+	"metrics[] registers must be within the register cache");
+static_assert(planGapsSafe(read_plans[TIER_FAST]) && planGapsSafe(read_plans[TIER_NORMAL]) && planGapsSafe(read_plans[TIER_SLOW]) && planGapsSafe(read_plans[TIER_MINUTE]),
+	"read plan blocks below READ_PLAN_GAP_START must not bridge gaps");
+
+// per-phase power and voltage for the history log
+constexpr uint8_t metric_power = findMetric(metrics, PmeanA);
+constexpr uint8_t metric_voltage = findMetric(metrics, UrmsA);
+static_assert((metric_power < METRIC_COUNT) && (metric_voltage < METRIC_COUNT), "history needs power and voltage of phase A - C");
+static_assert(metrics[metric_voltage].tier == TIER_NORMAL, "history reads the voltage sample of the normal tier");
+
+// first rollup value of every metric, ROLLUP_NONE for metrics that are not shown on the main page
+#define ROLLUP_NONE 0xFF
+uint8_t rollup_first[METRIC_COUNT];
+static_assert(countMainValues(metrics) <= ROLLUP_VALUES_MAX, "too many main page values for the rollups");
+static_assert(countMainValues(metrics) <= INFLUX_VALUES_MAX, "too many main page values for the influx records");
+
+// ring buffers of all metrics and phases, with the depth of the metric's tier
+int32_t sample_arena[metric_layout.arena_length];
+
+// former per-value heap blocks: data plus umm_malloc block header
+#define HEAP_BLOCK_OVERHEAD 8
+const size_t sample_store_bytes = sizeof(sample_arena);
+const size_t sample_store_heap_reclaimed = sizeof(sample_arena) + VALUE_COUNT * HEAP_BLOCK_OVERHEAD;
+
+// ring buffer of a slot
+int32_t *sampleBuffer(uint8_t slot)
+{
+	return sample_arena + metric_layout.slot_offset[slot];
+}
+
+// index of next value to be replaced, number of values in the ring buffer and number of values to average per tier
+uint8_t tier_index_nextvalue[TIER_COUNT];
+uint8_t tier_filled[TIER_COUNT];
+uint8_t tier_window[TIER_COUNT];
+
+// position of the weights of a tier in sample_weights
+constexpr uint16_t tierWeightOffset(uint8_t tier)
+{
+	return tier ? tierWeightOffset(tier - 1) + sample_tiers[tier - 1].depth : 0;
+}
+
+// weight of every sample in the averages: the real interval since the previous sample of its tier, in whole
+// tier intervals (see sampleWeight()). tier_weight_sum is the sum of the weights in the window of the tier
+uint8_t sample_weights[tierWeightOffset(TIER_COUNT)];
+uint16_t tier_weight_sum[TIER_COUNT];
+// time of the previous sample of every tier, invalid after the buffers were reset
+unsigned long tier_previous_us[TIER_COUNT];
+bool tier_previous_valid[TIER_COUNT];
+
+// running weighted sum, minimum and maximum of the values in every ring buffer, updated when a sample is stored
+int64_t sample_sums[VALUE_COUNT];
+int32_t sample_min[VALUE_COUNT];
+int32_t sample_max[VALUE_COUNT];
+
+// rendered responses, valid from the first request after a normal tier sample until the next one.
+// the fast tier samples in between are only shown with the next tick, they change the averages very little
+char cache_metrics_data[CACHE_METRICS_LENGTH];
+char cache_metricsnew_data[CACHE_METRICSNEW_LENGTH];
+
+struct ResponseCache cache_metrics = {cache_metrics_data, CACHE_METRICS_LENGTH, 0, false};
+struct ResponseCache cache_metricsnew = {cache_metricsnew_data, CACHE_METRICSNEW_LENGTH, 0, false};
+
+// format raw_sum / count of a metric in its unit into buffer (FORMAT_BUFFER_LENGTH), returns the length
+uint8_t formatValue(char *buffer, const struct Metric &metric, int64_t raw_sum, uint16_t count)
+{
+	int64_t denominator = (int64_t)metric.factor_denominator * count;
+
+	if(hasLSB(metric.type))
+		denominator <<= 8;
+
+	return formatFixed(buffer, raw_sum * metric.factor_numerator, denominator, metric.decimals);
+}
+
+// time weighted average of the last tier_window samples of a value
+uint8_t formatAverage(char *buffer, uint8_t index_metric, uint8_t index_phase)
+{
+	const struct Metric &metric = metrics[index_metric];
+
+	uint16_t weight = tier_weight_sum[metric.tier];
+
+	if(!weight)
+		return formatValue(buffer, metric, 0, 1);
+
+	return formatValue(buffer, metric, sample_sums[metric_layout.first_slot[index_metric] + index_phase], weight);
+}
+
+// minimum / maximum of the last tier_window samples of a value
+uint8_t formatExtreme(char *buffer, uint8_t index_metric, uint8_t index_phase, bool maximum)
+{
+	const struct Metric &metric = metrics[index_metric];
+	uint8_t slot = metric_layout.first_slot[index_metric] + index_phase;
+
+	if(!tier_filled[metric.tier])
+		return formatValue(buffer, metric, 0, 1);
+
+	return formatValue(buffer, metric, maximum ? sample_max[slot] : sample_min[slot], 1);
+}
+
+// position of the most recent sample in the ring buffers of a tier
+uint8_t latestIndex(uint8_t tier)
+{
+	uint8_t index = tier_index_nextvalue[tier];
+
+	return (index ? index : tier_window[tier]) - 1;
+}
+
+// false until the tier of a metric has stored its first sample since boot or resetMetrics()
+bool metricSampled(uint8_t index_metric)
+{
+	return tier_filled[metrics[index_metric].tier];
+}
+
+// most recent raw sample of a value, 0 if it was not sampled yet (see metricSampled())
+int32_t latestRaw(uint8_t index_metric, uint8_t index_phase)
 {
+	if(!metricSampled(index_metric))
+		return 0;
+
+	return sampleRaw(index_metric, index_phase, latestIndex(metrics[index_metric].tier));
+}
+
+// raw sample at index of the ring buffer of a value
+int32_t sampleRaw(uint8_t index_metric, uint8_t index_phase, uint8_t index)
+{
+	return sampleBuffer(metric_layout.first_slot[index_metric] + index_phase)[index];
+}
+
+// running weighted sum of the samples in the window of a value
+int64_t sampleSum(uint8_t index_metric, uint8_t index_phase)
+{
+	return sample_sums[metric_layout.first_slot[index_metric] + index_phase];
+}
+
+uint8_t storedWeight(uint8_t tier, uint8_t index)
+{
+	return sample_weights[tierWeightOffset(tier) + index];
+}
+
+uint8_t tierFilled(uint8_t tier)
+{
+	return tier_filled[tier];
+}
+
+uint8_t metricCount()
+{
+	return METRIC_COUNT;
+}
+
+const struct Metric &metricAt(uint8_t index_metric)
+{
+	return metrics[index_metric];
+}
+
+// energy total (0.1 Wh) in kWh
+uint8_t formatEnergy(char *buffer, int64_t energy)
+{
+	return formatFixed(buffer, energy, 10000, 4);
+}
+
+// latest samples of the main metrics as one text line for the push
+void encodeMetricsText(uint32_t sequence, uint16_t offset_ms)
+{
+	char number_buffer[FORMAT_BUFFER_LENGTH];
+
 	message_buffer.remove(0);
-	message_buffer += "name:power loc:main|";
+	message_buffer += "name:power loc:main seq:";
+	formatInteger(number_buffer, sequence);
+	message_buffer += number_buffer;
+	message_buffer += " offset_ms:";
+	formatInteger(number_buffer, offset_ms);
+	message_buffer += number_buffer;
+	message_buffer += "|";
 
 	for(uint8_t index_metric = 0; index_metric < METRIC_COUNT; index_metric++)
 	{
-		struct Metric metric = metrics[index_metric];
+		const struct Metric &metric = metrics[index_metric];
 
-		if (!metric.showInMain)
+		if((!metric.showInMain) || (!metricSampled(index_metric)))
 			continue;
 
-		uint8_t phasecount = strlen(metric.phases);
+		uint8_t phasecount = metric_layout.phase_count[index_metric];
 
 		for(uint8_t index_phase = 0; index_phase < phasecount; index_phase++)
 		{
-			int32_t value_int = metric.values[index_phase][index];
-			double value = value_int * metric.factor;
-
-			if(metric.type == LSB_COMPLEMENT || metric.type == LSB_UNSIGNED)
-				value /= (1 << 8);
+			formatValue(number_buffer, metric, latestRaw(index_metric, index_phase), 1);
 
 			message_buffer += "name:";
 			message_buffer += metrics[index_metric].name;
@@ -127,7 +263,7 @@ void sendMetricsSocket(uint8_t index)
 			message_buffer += metrics[index_metric].phases[index_phase];
 
 			message_buffer += " ";
-			message_buffer += String(value, metric.decimals);
+			message_buffer += number_buffer;
 			message_buffer += "|";
 		}
 	}
@@ -136,146 +272,674 @@ void sendMetricsSocket(uint8_t index)
 
 	for(uint8_t i = 0; i < 4; i++)
 	{
+		formatEnergy(number_buffer, setting_energy_total[i]);
+
 		message_buffer += "name:energy phase:";
 		message_buffer += phases[i];
 		message_buffer += " ";
+		message_buffer += number_buffer;
+		message_buffer += "|";
+	}
 
-		if(setting_energy_total[i] < 0)
-			message_buffer += "-";
+	message_buffer += "\n";
+}
 
-		int64_t abs_total_energy = abs(setting_energy_total[i]);
-		message_buffer += int64_to_string(abs_total_energy / 10000) + ".";
+constexpr uint32_t schema_hash = makeSchemaHash(metrics);
+static_assert(sizeof(struct BinaryHeader) == 20, "binary header must not contain padding");
 
-		String fractionalstr = String((uint16_t)(abs_total_energy % 10000));
+uint8_t binary_buffer[sizeof(struct BinaryHeader) + VARINT32_LENGTH_MAX + BINARY_PRESENCE_LENGTH(VALUE_COUNT) + VALUE_COUNT * VARINT32_LENGTH_MAX +
+	BINARY_ENERGY_COUNT * VARINT_LENGTH_MAX];
 
-		for(uint8_t i = fractionalstr.length(); i < 4; i++)
-			message_buffer += "0";
+// previous sample of a push datagram, the base of the differences
+int32_t binary_previous[VALUE_COUNT];
+int64_t binary_previous_energy[BINARY_ENERGY_COUNT];
 
-		message_buffer += fractionalstr;
-		message_buffer += "|";
+// binary encoding (see binary.h) of one sample of all metrics into binary_buffer, returns the length.
+// push: latest samples for the push datagram, otherwise the averages for /metrics.bin.
+// the header is only written for the first sample of a datagram, the values of the other samples are
+// differences to the sample before. values of tiers that were not sampled yet are left out
+uint16_t encodeMetricsBinary(bool push, bool first, uint32_t sequence, uint16_t offset_ms)
+{
+	uint16_t length = 0;
+
+	if(first)
+	{
+		struct BinaryHeader header = {{'T', 'P', 'M', 'B'}, BINARY_VERSION, 0, VALUE_COUNT, BINARY_ENERGY_COUNT, schema_hash, rollupSeconds(), sequence};
+
+		if(push)
+			header.flags |= BINARY_FLAG_LATEST;
+
+		memcpy(binary_buffer, &header, sizeof(header));
+		length = sizeof(header);
 	}
 
-	message_buffer += "\n";
+	length += formatVarint(binary_buffer + length, offset_ms);
+
+	uint8_t *presence = binary_buffer + length;
+	memset(presence, 0, BINARY_PRESENCE_LENGTH(VALUE_COUNT));
+	length += BINARY_PRESENCE_LENGTH(VALUE_COUNT);
+
+	for(uint8_t index_metric = 0; index_metric < METRIC_COUNT; index_metric++)
+	{
+		uint16_t weight = tier_weight_sum[metrics[index_metric].tier];
+		bool sampled = metricSampled(index_metric);
+
+		for(uint8_t index_phase = 0; index_phase < metric_layout.phase_count[index_metric]; index_phase++)
+		{
+			uint8_t slot = metric_layout.first_slot[index_metric] + index_phase;
+
+			if(!sampled)
+			{
+				// the decoder starts every datagram from 0
+				if(first)
+					binary_previous[slot] = 0;
+				continue;
+			}
+
+			presence[slot / 8] |= 1 << (slot % 8);
+
+			int32_t raw;
+
+			if(push)
+				raw = latestRaw(index_metric, index_phase);
+			else
+				raw = divideRounded(sample_sums[slot], weight);
+
+			length += formatVarint(binary_buffer + length, first ? raw : (int64_t)raw - binary_previous[slot]);
+
+			if(push)
+				binary_previous[slot] = raw;
+		}
+	}
+
+	for(uint8_t i = 0; i < BINARY_ENERGY_COUNT; i++)
+	{
+		int64_t energy = setting_energy_total[i];
+
+		length += formatVarint(binary_buffer + length, first ? energy : energy - binary_previous_energy[i]);
+
+		if(push)
+			binary_previous_energy[i] = energy;
+	}
+
+	return length;
+}
+
+// adds the latest samples to the push datagram in the format of setting_push_format
+void pushMetrics(unsigned long time_us)
+{
+	if(!pushEnabled())
+		return;
+
+	// a sample that does not fit any more starts the next datagram
+	for(uint8_t attempt = 0; attempt < 2; attempt++)
+	{
+		bool first = !pushSamples();
+		const uint8_t *data;
+		uint16_t length;
+
+		if(setting_push_format == PUSH_FORMAT_BINARY)
+		{
+			length = encodeMetricsBinary(true, first, pushSequence(), pushOffsetMs(time_us));
+			data = binary_buffer;
+		}
+		else
+		{
+			encodeMetricsText(pushSequence(), pushOffsetMs(time_us));
+			length = message_buffer.length();
+			data = (const uint8_t*)message_buffer.c_str();
+		}
+
+		if(pushAppend(data, length, time_us) || first)
+			return;
+
+		pushFlush();
+	}
+}
+
+// JSON object of publishMetricsMqtt(), not in message_buffer: a request handler may run while the packets are written
+String mqtt_payload;
+
+// values of the per-topic round (MQTT_FORMAT_TOPICS) that started with the last publish tick: the next one and their
+// number. values are published as long as mqttReady() allows, with QoS 1 the rest follow from handleMetricsMqtt()
+// as the broker acknowledges the messages in flight
+uint8_t mqtt_round_next = 0;
+uint8_t mqtt_round_count = 0;
+
+// value number index of a round (metrics[] and their phases, then the energy totals): topic name and value,
+// 0 for a value that was not sampled yet
+uint8_t formatMqttValue(uint8_t index, char *name, uint8_t name_length, char *number_buffer)
+{
+	const char phases[] = "TABC";
+
+	for(uint8_t index_metric = 0; index_metric < METRIC_COUNT; index_metric++)
+	{
+		uint8_t phase_count = metric_layout.phase_count[index_metric];
+
+		if(index >= phase_count)
+		{
+			index -= phase_count;
+			continue;
+		}
+
+		const struct Metric &metric = metrics[index_metric];
+
+		if(!metricSampled(index_metric))
+			return 0;
+
+		snprintf(name, name_length, "%s/%c", metric.name, metric.phases[index]);
+		return formatValue(number_buffer, metric, latestRaw(index_metric, index), 1);
+	}
+
+	snprintf(name, name_length, "energy_total/%c", phases[index]);
+	return formatEnergy(number_buffer, setting_energy_total[index]);
+}
+
+void handleMetricsMqtt()
+{
+	if(mqtt_round_next >= mqtt_round_count)
+		return;
+
+	char number_buffer[FORMAT_BUFFER_LENGTH];
+	char topic[MQTT_TOPIC_LENGTH];
+
+	uint8_t prefix_length = snprintf(topic, sizeof(topic), "%s/%s/", setting_metric_name, setting_location_tag);
+
+	while(mqtt_round_next < mqtt_round_count)
+	{
+		uint8_t length = formatMqttValue(mqtt_round_next, topic + prefix_length, sizeof(topic) - prefix_length, number_buffer);
+
+		if(!length)
+		{
+			mqtt_round_next++;
+			continue;
+		}
+
+		if(!mqttReady(strlen(topic), length))
+			break;
+
+		mqttPublish(topic, number_buffer, length);
+		mqtt_round_next++;
+	}
+
+	mqttFlush();
+}
+
+// latest samples of all metrics and the energy totals, as one JSON object or one topic per value (setting_mqtt_format).
+// values of tiers that were not sampled yet are left out
+void publishMetricsMqtt()
+{
+	if(!mqttTick())
+		return;
+
+	if(setting_mqtt_format == MQTT_FORMAT_TOPICS)
+	{
+		// values of the last round that are still waiting are replaced by the new round
+		mqtt_messages_dropped += mqtt_round_count - mqtt_round_next;
+
+		mqtt_round_next = 0;
+		mqtt_round_count = 4;
+
+		for(uint8_t index_metric = 0; index_metric < METRIC_COUNT; index_metric++)
+			mqtt_round_count += metric_layout.phase_count[index_metric];
+
+		handleMetricsMqtt();
+		return;
+	}
+
+	char number_buffer[FORMAT_BUFFER_LENGTH];
+	char topic[MQTT_TOPIC_LENGTH];
+	const char phases[] = "TABC";
+
+	mqtt_payload.remove(0);
+	mqtt_payload += "{\"uptime_s\":";
+	formatInteger(number_buffer, rollupSeconds());
+	mqtt_payload += number_buffer;
+
+	for(uint8_t index_metric = 0; index_metric < METRIC_COUNT; index_metric++)
+	{
+		const struct Metric &metric = metrics[index_metric];
+
+		if(!metricSampled(index_metric))
+			continue;
+
+		for(uint8_t index_phase = 0; index_phase < metric_layout.phase_count[index_metric]; index_phase++)
+		{
+			formatValue(number_buffer, metric, latestRaw(index_metric, index_phase), 1);
+
+			mqtt_payload += ",\"";
+			mqtt_payload += metric.name;
+			mqtt_payload += '_';
+			mqtt_payload += metric.phases[index_phase];
+			mqtt_payload += "\":";
+			mqtt_payload += number_buffer;
+		}
+	}
+
+	for(uint8_t i = 0; i < 4; i++)
+	{
+		formatEnergy(number_buffer, setting_energy_total[i]);
+
+		mqtt_payload += ",\"energy_total_";
+		mqtt_payload += phases[i];
+		mqtt_payload += "\":";
+		mqtt_payload += number_buffer;
+	}
+
+	mqtt_payload += '}';
+	snprintf(topic, sizeof(topic), "%s/%s/metrics", setting_metric_name, setting_location_tag);
+	mqttPublish(topic, mqtt_payload.c_str(), mqtt_payload.length());
+
+	mqttFlush();
+}
+
+void captureInfluxRecord(struct InfluxRecord &record)
+{
+	uint8_t index = 0;
+
+	for(uint8_t index_metric = 0; index_metric < METRIC_COUNT; index_metric++)
+	{
+		if(!metrics[index_metric].showInMain)
+			continue;
+
+		uint16_t weight = tier_weight_sum[metrics[index_metric].tier];
+
+		for(uint8_t index_phase = 0; index_phase < metric_layout.phase_count[index_metric]; index_phase++)
+		{
+			uint8_t slot = metric_layout.first_slot[index_metric] + index_phase;
+
+			record.values[index++] = weight ? divideRounded(sample_sums[slot], weight) : 0;
+		}
+	}
+
+	record.value_count = index;
+
+	for(uint8_t i = 0; i < 4; i++)
+		record.energy[i] = setting_energy_total[i];
+}
+
+void appendInfluxLines(String &lines, const struct InfluxRecord &record, uint32_t epoch)
+{
+	char number_buffer[FORMAT_BUFFER_LENGTH];
+	char time_buffer[FORMAT_BUFFER_LENGTH];
+	const char phases[] = "TABC";
+
+	formatInteger(time_buffer, epoch);
+
+	for(uint8_t index_phase = 0; index_phase < 4; index_phase++)
+	{
+		lines += setting_metric_name;
+		lines += ",loc=";
+		lines += setting_location_tag;
+		lines += ",phase=";
+		lines += phases[index_phase];
+		lines += ' ';
+
+		uint8_t index = 0;
+
+		for(uint8_t index_metric = 0; index_metric < METRIC_COUNT; index_metric++)
+		{
+			const struct Metric &metric = metrics[index_metric];
+
+			if(!metric.showInMain)
+				continue;
+
+			const char *phase_ptr = strchr(metric.phases, phases[index_phase]);
+
+			if(phase_ptr)
+			{
+				formatValue(number_buffer, metric, record.values[index + (phase_ptr - metric.phases)], 1);
+
+				lines += metric.name;
+				lines += '=';
+				lines += number_buffer;
+				lines += ',';
+			}
+
+			index += metric_layout.phase_count[index_metric];
+		}
+
+		formatEnergy(number_buffer, record.energy[index_phase]);
 
-	pushUdp.beginPacket(IPAddress(192, 168, 2, 91), 8001);
-	pushUdp.write(message_buffer.c_str(), message_buffer.length());
-	pushUdp.endPacket();
+		lines += "energy_total=";
+		lines += number_buffer;
+		lines += ' ';
+		lines += time_buffer;
+		// nanoseconds, the default precision of the /write API
+		lines += "000000000\n";
+	}
 }
 
 // last time taken to read all metrics from the ATM90E36A (in microseconds)
 unsigned long lastMetricReadTime = 0;
-// fill value buffers completely before serving metrics to webpage
+// fill value buffers of the normal tier completely before serving metrics to webpage
 uint8_t webpage_wait_counter = SAMPLE_COUNT_MAX;
-// index of next value to be replaced
-uint8_t index_nextvalue = 0;
+// time and zero crossing count of every sample of the normal tier
+unsigned long sample_time_us[SAMPLE_COUNT_MAX];
+uint32_t sample_cycles[SAMPLE_COUNT_MAX];
+
+// state of the sample that is currently being read by continueMetricsRead()
+bool sample_in_progress = false;
+unsigned long sample_pending_time_us = 0;
+uint32_t sample_pending_cycles = 0;
+// tiers that still have to be read, the lowest one is being read right now
+uint8_t read_tiers = 0;
+uint8_t read_index_block = 0;
+uint8_t read_offset = 0;
+unsigned long read_duration = 0;
 
 void initMetrics()
 {
+	uint8_t rollup_index = 0;
+
 	for(uint8_t index_metric = 0; index_metric < METRIC_COUNT; index_metric++)
 	{
-		int8_t phasecount = strlen(metrics[index_metric].phases);
+		const struct Metric &metric = metrics[index_metric];
 
-		metrics[index_metric].values = (int32_t**)malloc(phasecount * sizeof(int32_t*));
+		rollup_first[index_metric] = metric.showInMain ? rollup_index : ROLLUP_NONE;
 
-		for(uint8_t index_phase = 0; index_phase < phasecount; index_phase++)
-			metrics[index_metric].values[index_phase] = (int32_t*)malloc(SAMPLE_COUNT_MAX * sizeof(int32_t));
+		if(!metric.showInMain)
+			continue;
+
+		// the rollups keep the 16 bit register of a value
+		for(uint8_t index_phase = 0; index_phase < metric_layout.phase_count[index_metric]; index_phase++)
+			rollupEncoding(rollup_index++, ((metric.type == LSB_UNSIGNED) || (metric.type == LSB_COMPLEMENT)) ? 8 : 0,
+				(metric.type == LSB_UNSIGNED) || (metric.type == NOLSB_UNSIGNED));
 	}
 
+	initRollups(rollup_index);
+
 	resetMetrics();
 
-	pushUdp.begin(6666);
+	halUdpBegin(6666);
+	configurePush();
 }
 
 void resetMetrics()
 {
 	webpage_wait_counter = setting_sample_count + 2;
-	index_nextvalue = 0;
+	sample_in_progress = false;
+
+	for(uint8_t tier = 0; tier < TIER_COUNT; tier++)
+	{
+		// average over the same time span as the normal tier, but at least over one sample
+		uint16_t window = (setting_sample_count * SAMPLE_INTERVAL_MS) / sample_tiers[tier].interval_ms;
+
+		tier_window[tier] = constrain(window, 1, sample_tiers[tier].depth);
+		tier_index_nextvalue[tier] = 0;
+		tier_filled[tier] = 0;
+		tier_weight_sum[tier] = 0;
+		tier_previous_valid[tier] = false;
+	}
+
+	for(uint8_t slot = 0; slot < VALUE_COUNT; slot++)
+		sample_sums[slot] = 0;
+
+	invalidateMetricsCache();
 }
 
-void getMetricsNew(int8_t index)
+void invalidateMetricsCache()
 {
-	message_buffer.remove(0);
+	responseCacheInvalidate(cache_metrics);
+	responseCacheInvalidate(cache_metricsnew);
+}
+
+void getMetricsNew(bool latest)
+{
+	char number_buffer[FORMAT_BUFFER_LENGTH];
 
 	char phases[] = "TABC";
 
 	for(uint8_t index_phase = 0; index_phase < 4; index_phase++)
 	{
-		message_buffer += "power,loc=main,phase=";
-		message_buffer += phases[index_phase];
-		message_buffer += " ";
+		responseWrite("power,loc=main,phase=");
+		responseWrite(phases[index_phase]);
+		responseWrite(' ');
 
 		for(uint8_t index_metric = 0; index_metric < METRIC_COUNT; index_metric++)
 		{
-			struct Metric metric = metrics[index_metric];
+			const struct Metric &metric = metrics[index_metric];
 
 			if (!metric.showInMain)
 				continue;
 
-			char *phase_ptr = strchr(metric.phases, phases[index_phase]);
+			const char *phase_ptr = strchr(metric.phases, phases[index_phase]);
 
 			if(!phase_ptr)
 				continue;
 
 			uint8_t offset_phase = phase_ptr - metric.phases;
 
-			double value;
+			if(latest)
+				formatValue(number_buffer, metric, latestRaw(index_metric, offset_phase), 1);
+			else
+				formatAverage(number_buffer, index_metric, offset_phase);
+
+			responseWrite(metric.name);
+			responseWrite('=');
+			responseWrite(number_buffer);
+			responseWrite(',');
 
-			if(index < 0)
+			if(!latest)
 			{
-				int64_t valuesum = 0;
+				formatExtreme(number_buffer, index_metric, offset_phase, false);
+				responseWrite(metric.name);
+				responseWrite("_min=");
+				responseWrite(number_buffer);
+				responseWrite(',');
+
+				formatExtreme(number_buffer, index_metric, offset_phase, true);
+				responseWrite(metric.name);
+				responseWrite("_max=");
+				responseWrite(number_buffer);
+				responseWrite(',');
+			}
+		}
 
-				int *valueptr = metric.values[offset_phase];
+		formatEnergy(number_buffer, setting_energy_total[index_phase]);
 
-				for(uint8_t i = 0; i < setting_sample_count; i++)
-					valuesum += *(valueptr++);
+		responseWrite("energy_total=");
+		responseWrite(number_buffer);
+		responseWrite('\n');
+	}
+}
 
-				value = valuesum * metric.factor / setting_sample_count;
-			}
-			else
-			{
-				int *valueptr = metric.values[offset_phase];
+const uint8_t total_energy_write_interval = 50;
+uint8_t total_energy_countdown = total_energy_write_interval;
 
-				value = valueptr[index] * metric.factor;
-			}
+// copy of the registers 0x80 - 0xFF, filled by continueMetricsRead()
+uint16_t register_cache[REGISTER_CACHE_SIZE];
+
+// store value at index of the ring buffer of slot and update its weighted sum, minimum and maximum.
+// evict: the buffer is full and the old value at index (stored with old_weight) leaves the window,
+// count: number of values in the window
+void storeValue(uint8_t slot, uint8_t index, int32_t value, uint8_t weight, uint8_t old_weight, bool evict, uint8_t count)
+{
+	int32_t *values = sampleBuffer(slot);
+	int32_t old = values[index];
+
+	values[index] = value;
 
+	sample_sums[slot] += (int64_t)value * weight;
 
-			if(metric.type == LSB_COMPLEMENT || metric.type == LSB_UNSIGNED)
-				value /= (1 << 8);
+	if(evict)
+		sample_sums[slot] -= (int64_t)old * old_weight;
+
+	if(count == 1)
+	{
+		sample_min[slot] = value;
+		sample_max[slot] = value;
+	}
+	else if(evict && ((old == sample_min[slot]) || (old == sample_max[slot])))
+	{
+		// the old extreme left the window, rescan
+		int32_t minimum = value;
+		int32_t maximum = value;
 
-			message_buffer += String(metric.name) + "=" + String(value, metric.decimals) + ",";
+		for(uint8_t i = 0; i < count; i++)
+		{
+			minimum = min(minimum, values[i]);
+			maximum = max(maximum, values[i]);
 		}
 
-		message_buffer += "energy_total=";
+		sample_min[slot] = minimum;
+		sample_max[slot] = maximum;
+	}
+	else
+	{
+		sample_min[slot] = min(sample_min[slot], value);
+		sample_max[slot] = max(sample_max[slot], value);
+	}
+}
 
-		if(setting_energy_total[index_phase] < 0)
-			message_buffer += "-";
+// decode all values of one type from the register cache into the sample buffers
+template<enum ValueType type>
+void decodeValues(const ReadPlan<VALUE_COUNT> &plan, uint8_t index, uint8_t weight, uint8_t old_weight, bool evict, uint8_t count)
+{
+	for(uint8_t index_step = plan.type_start[type]; index_step < plan.type_start[type + 1]; index_step++)
+	{
+		const struct DecodeStep &step = plan.steps[index_step];
+		storeValue(step.slot, index, decodeValue<type>(register_cache[step.msb], register_cache[step.lsb]), weight, old_weight, evict, count);
+	}
+}
 
-		int64_t abs_total_energy = abs(setting_energy_total[index_phase]);
-		message_buffer += int64_to_string(abs_total_energy / 10000) + ".";
+// weight of the pending sample of a tier: the number of tier intervals since the previous sample, so the samples
+// after skipped ticks stand for the time they cover. 1 for every sample of an undisturbed tier
+uint8_t sampleWeight(uint8_t tier)
+{
+	if(!tier_previous_valid[tier])
+		return 1;
 
-		String fractionalstr = String((uint16_t)(abs_total_energy % 10000));
+	unsigned long interval_us = sample_tiers[tier].interval_ms * 1000UL;
+	unsigned long intervals = (sample_pending_time_us - tier_previous_us[tier] + interval_us / 2) / interval_us;
 
-		for(uint8_t y = fractionalstr.length(); y < 4; y++)
-			message_buffer += "0";
+	return constrain(intervals, 1UL, (unsigned long)SAMPLE_WEIGHT_MAX);
+}
 
-		message_buffer += fractionalstr + "\n";
-	}
+// lowest tier in a bit mask of tiers
+uint8_t firstTier(uint8_t tiers)
+{
+	uint8_t tier = 0;
+
+	while(!(tiers & (1 << tier)))
+		tier++;
+
+	return tier;
 }
 
-const uint8_t total_energy_write_interval = 50;
-uint8_t total_energy_countdown = total_energy_write_interval;
+void startMetricsRead(uint8_t tiers, unsigned long tick_time_us, uint32_t tick_cycles)
+{
+	if(!tiers)
+		return;
+
+	sample_pending_time_us = tick_time_us;
+	sample_pending_cycles = tick_cycles;
+
+	read_tiers = tiers;
+	read_index_block = 0;
+	read_offset = 0;
+	read_duration = 0;
+
+	sample_in_progress = true;
+}
+
+bool metricsReadBusy()
+{
+	return sample_in_progress;
+}
+
+// a normal tier sample has been stored by commitMetrics(), its FRAM writes and network output run from loop() in
+// handleMetricsCommit() instead of within the time budget of the read slice
+bool sample_commit_pending = false;
+unsigned long sample_commit_time_us = 0;
 
-void readMetrics()
+// all registers of a tier have been read, store the sample in the buffers of the tier
+void commitMetrics(uint8_t tier)
 {
-	unsigned long starttime = micros();
+	const ReadPlan<VALUE_COUNT> &plan = read_plans[tier];
+	uint8_t index = tier_index_nextvalue[tier];
+
+	bool evict = (tier_filled[tier] >= tier_window[tier]);
+
+	if(!evict)
+		tier_filled[tier]++;
+
+	uint8_t *weights = sample_weights + tierWeightOffset(tier);
+	uint8_t weight = sampleWeight(tier);
+	uint8_t old_weight = evict ? weights[index] : 0;
+
+	weights[index] = weight;
+	tier_weight_sum[tier] += weight - old_weight;
+
+	decodeValues<LSB_UNSIGNED>(plan, index, weight, old_weight, evict, tier_filled[tier]);
+	decodeValues<LSB_COMPLEMENT>(plan, index, weight, old_weight, evict, tier_filled[tier]);
+	decodeValues<NOLSB_UNSIGNED>(plan, index, weight, old_weight, evict, tier_filled[tier]);
+	decodeValues<NOLSB_SIGNED>(plan, index, weight, old_weight, evict, tier_filled[tier]);
+
+	if((tier == TIER_NORMAL) && tier_previous_valid[tier])
+		histogramAdd(histogram_tick, sample_pending_time_us - tier_previous_us[tier]);
+
+	tier_previous_us[tier] = sample_pending_time_us;
+	tier_previous_valid[tier] = true;
+
+	rollupUpdate();
+
+	for(uint8_t index_metric = 0; index_metric < METRIC_COUNT; index_metric++)
+	{
+		if((metrics[index_metric].tier != tier) || (rollup_first[index_metric] == ROLLUP_NONE))
+			continue;
+
+		for(uint8_t index_phase = 0; index_phase < metric_layout.phase_count[index_metric]; index_phase++)
+			rollupAdd(rollup_first[index_metric] + index_phase, sampleBuffer(metric_layout.first_slot[index_metric] + index_phase)[index]);
+	}
+
+	if(++tier_index_nextvalue[tier] >= tier_window[tier])
+		tier_index_nextvalue[tier] = 0;
+
+	if(tier != TIER_NORMAL)
+		return;
+
+	invalidateMetricsCache();
+
+	sample_time_us[index] = sample_pending_time_us;
+	sample_cycles[index] = sample_pending_cycles;
 
 	if(webpage_wait_counter)
 		webpage_wait_counter--;
 
 	for(uint8_t i = 0; i < 4; i++)
-		setting_energy_total[i] += readATM90E36(APenergyT + i);
+		setting_energy_total[i] += register_cache[APenergyT - REGISTER_CACHE_START + i];
 	for(uint8_t i = 0; i < 4; i++)
-		setting_energy_total[i] -= readATM90E36(ANenergyT + i);
+		setting_energy_total[i] -= register_cache[ANenergyT - REGISTER_CACHE_START + i];
+
+	sample_commit_pending = true;
+	sample_commit_time_us = sample_pending_time_us;
+}
+
+void handleMetricsCommit()
+{
+	if(!sample_commit_pending)
+		return;
+
+	sample_commit_pending = false;
+
+	// no history record before power and voltage have their first sample
+	if(metricSampled(metric_power) && metricSampled(metric_voltage))
+	{
+		int16_t power[3];
+		uint16_t voltage[3];
+
+		for(uint8_t phase = 0; phase < 3; phase++)
+		{
+			const struct Metric &metric = metrics[metric_power];
+			int64_t value = divideRounded((int64_t)latestRaw(metric_power, phase) * metric.factor_numerator, (int64_t)metric.factor_denominator << 8);
+
+			power[phase] = constrain(value, -32768, 32767);
+			voltage[phase] = latestRaw(metric_voltage, phase) >> 8;
+		}
+
+		historySample(power, voltage);
+	}
 
 	if(total_energy_countdown)
 		total_energy_countdown--;
@@ -286,158 +950,350 @@ void readMetrics()
 			save_setting(i);
 	}
 
-	for(uint8_t index_metric = 0; index_metric < METRIC_COUNT; index_metric++)
+	pushMetrics(sample_commit_time_us);
+
+	if(!webpage_wait_counter)
 	{
-		struct Metric metric = metrics[index_metric];
+		influxSample();
+		publishMetricsMqtt();
+	}
+}
 
-		uint8_t phasecount = strlen(metric.phases);
+bool continueMetricsRead(unsigned long budget_us)
+{
+	if(!sample_in_progress)
+		return false;
 
-		for(uint8_t index_phase = 0; index_phase < phasecount; index_phase++)
-		{
-			int32_t value;
+	unsigned long starttime = halMicros();
+	bool split;
 
-			if(metric.type == LSB_COMPLEMENT)
-			{
-				uint32_t val = readATM90E36(metric.address + index_phase);
+	do
+	{
+		uint8_t tier = firstTier(read_tiers);
+		const ReadPlan<VALUE_COUNT> &plan = read_plans[tier];
 
-				if(val & 0x8000)
-					val |= 0xFF0000;
+		if(read_index_block < plan.block_count)
+		{
+			const struct RegisterBlock &block = plan.blocks[read_index_block];
 
-				uint16_t lsb = (unsigned short)readATM90E36(metric.address + index_phase + 0x10);
+			uint8_t count = block.count - read_offset;
+			if(count > READ_SLICE_REGISTERS)
+				count = READ_SLICE_REGISTERS;
 
-				val = (val << 8) + (lsb >> 8);
+			uint16_t address = block.address + read_offset;
+			readATM90E36Block(address, register_cache + address - REGISTER_CACHE_START, count);
 
-				value = (int32_t)val;
-			}
-			else if(metric.type == LSB_UNSIGNED)
-			{
-				value = (unsigned short)readATM90E36(metric.address + index_phase);
-				uint16_t lsb = (unsigned short)readATM90E36(metric.address + index_phase + 0x10);
-				value = (value << 8) + (lsb >> 8);
-			}
-			else if(metric.type == NOLSB_SIGNED)
+			read_offset += count;
+
+			if(read_offset >= block.count)
 			{
-				value = (signed short)readATM90E36(metric.address + index_phase);
+				read_offset = 0;
+				read_index_block++;
 			}
-			else //if (metric.type == NOLSB_UNSIGNED)
+		}
+
+		// the budget only ends a slice between blocks that keep the MSB and LSB of every value together
+		split = (!read_offset) && ((!read_index_block) || plan.blocks[read_index_block - 1].split);
+
+		if(read_index_block >= plan.block_count)
+		{
+			commitMetrics(tier);
+
+			read_tiers &= ~(1 << tier);
+			read_index_block = 0;
+			read_offset = 0;
+
+			if(!read_tiers)
 			{
-				value = (unsigned short)readATM90E36(metric.address + index_phase);
+				sample_in_progress = false;
+				lastMetricReadTime = read_duration + (halMicros() - starttime);
+				histogramAdd(histogram_spi, lastMetricReadTime);
+				return true;
 			}
+		}
+	} while((!split) || ((halMicros() - starttime) < budget_us));
 
-			metrics[index_metric].values[index_phase][index_nextvalue] = value;
+	read_duration += halMicros() - starttime;
+	return false;
+}
+
+void handleMetricsNew()
+{
+	if(webpage_wait_counter)
+	{
+		halHttpSend(404, "text/plain", "please wait for buffers to fill");
+		return;
+	}
+
+	responseBegin(200, "text/plain; version=0.0.4");
+
+	if(!responseWriteCached(cache_metricsnew))
+	{
+		getMetricsNew(false);
+		responseCacheStore();
+	}
+
+	responseEnd();
+}
+
+void writePreamble()
+{
+	responseWrite(setting_metric_name);
+	responseWrite(",loc=");
+	responseWrite(setting_location_tag);
+	responseWrite(",name=");
+}
+
+// one line of the averages of the main (or all) metrics and the energy totals, returns false if there is no such line
+bool writeMetricsLine(bool all, uint16_t line)
+{
+	char number_buffer[FORMAT_BUFFER_LENGTH];
+
+	for(uint8_t index_metric = 0; index_metric < METRIC_COUNT; index_metric++)
+	{
+		const struct Metric &metric = metrics[index_metric];
+
+		if((!all) && (!metric.showInMain))
+			continue;
+
+		uint8_t phasecount = metric_layout.phase_count[index_metric];
+
+		if(line >= phasecount)
+		{
+			line -= phasecount;
+			continue;
 		}
+
+		formatAverage(number_buffer, index_metric, line);
+
+		writePreamble();
+		responseWrite(metric.name);
+		responseWrite(",phase=");
+		responseWrite(metric.phases[line]);
+		responseWrite(" value=");
+		responseWrite(number_buffer);
+		responseWrite('\n');
+
+		return true;
 	}
 
-	/* ---------------------------------------------------------------------- */
+	if(line >= 4)
+		return false;
 
-	// if (pushClient.connected()) {
-	sendMetricsSocket(index_nextvalue);
-	// }
+	formatEnergy(number_buffer, setting_energy_total[line]);
 
-	/* ---------------------------------------------------------------------- */
+	writePreamble();
+	responseWrite("total_energy,phase=");
+	responseWrite("TABC"[line]);
+	responseWrite(" value=");
+	responseWrite(number_buffer);
+	responseWrite('\n');
 
-	// WiFiClient client;
-	// if (client.connect(IPAddress(192, 168, 2, 91), 10001))
-	// {
-	// 	getMetricsNew(index_nextvalue);
-	// 	client.println(message_buffer);
-	// 	client.flush();
-	// 	client.stop();
-	// }
+	return true;
+}
 
-	if(++index_nextvalue >= setting_sample_count)
-		index_nextvalue = 0;
+void handleMetrics()
+{
+	if(webpage_wait_counter)
+	{
+		halHttpSend(404, "text/plain", "please wait for buffers to fill");
+		return;
+	}
+
+	responseBegin(200, "text/plain; version=0.0.4");
+
+	if(!responseWriteCached(cache_metrics))
+	{
+		for(uint16_t line = 0; writeMetricsLine(false, line); line++);
+		responseCacheStore();
+	}
 
-	lastMetricReadTime = micros() - starttime;
+	responseEnd();
 }
 
+// one line per part, the averages of all metrics followed by the harmonics. cursor.index: first harmonics line
+bool renderAllMetrics(struct ResponseCursor &cursor)
+{
+	if(!cursor.index)
+	{
+		if(writeMetricsLine(true, cursor.part))
+			return true;
 
+		cursor.index = cursor.part;
+	}
 
-void handleMetricsNew()
+	return writeHarmonicsLine(cursor.part - cursor.index);
+}
+
+// the response is too long to be kept in RAM (about 15 kB with the harmonics), it is rendered while it is sent
+// and not cached
+void handleAllMetrics()
 {
 	if(webpage_wait_counter)
 	{
-		httpServer.send(404, "text/plain", "please wait for buffers to fill");
+		halHttpSend(404, "text/plain", "please wait for buffers to fill");
 		return;
 	}
 
-	getMetricsNew(-1);
+	struct ResponseCursor cursor = {};
 
-	httpServer.send(200, "text/plain; version=0.0.4", message_buffer);
+	responseSendParts(200, "text/plain; version=0.0.4", renderAllMetrics, cursor);
 }
 
-void handleMetricsInternal(bool all)
+void handleMetricsBinary()
 {
 	if(webpage_wait_counter)
 	{
-		httpServer.send(404, "text/plain", "please wait for buffers to fill");
+		halHttpSend(404, "text/plain", "please wait for buffers to fill");
 		return;
 	}
 
-	message_buffer.remove(0);
+	uint16_t length = encodeMetricsBinary(false, true, 0, 0);
 
-	String preamble = INFLUX_PREAMBLE;
+	halHttpBeginContent(200, "application/octet-stream", length);
+	halHttpSendContent((const char*)binary_buffer, length);
+	halHttpEndContent();
+}
 
-	for(uint8_t index_metric = 0; index_metric < METRIC_COUNT; index_metric++)
-	{
-		struct Metric metric = metrics[index_metric];
+void handleMetricsSchema()
+{
+	responseBegin(200, "text/plain");
 
-		if((!all) && (!metric.showInMain))
-			continue;
+	responseWrite("# version=");
+	responseWriteInteger(BINARY_VERSION);
+	responseWrite(" schema_hash=0x");
+	responseWriteHex(schema_hash);
+	responseWrite('\n');
 
-		uint8_t phasecount = strlen(metric.phases);
+	for(uint8_t index_metric = 0; index_metric < METRIC_COUNT; index_metric++)
+	{
+		const struct Metric &metric = metrics[index_metric];
+
+		responseWrite(metric.name);
+		responseWrite(' ');
+		responseWrite(metric.phases);
+		responseWrite(' ');
+		responseWriteInteger(metric.factor_numerator);
+		responseWrite(' ');
+		responseWriteInteger(metric.factor_denominator);
+		responseWrite(' ');
+		responseWriteInteger(hasLSB(metric.type) ? 8 : 0);
+		responseWrite(' ');
+		responseWriteInteger(metric.decimals);
+		responseWrite('\n');
+	}
 
-		for(uint8_t index_phase = 0; index_phase < phasecount; index_phase++)
-		{
-			int64_t valuesum = 0;
+	responseEnd();
+}
 
-			int *valueptr = metric.values[index_phase];
+// part 0 is the header, then one value of a bucket per part, oldest bucket first. cursor.option: level,
+// cursor.from: start of the next bucket to send (the ring moves on while the response is sent), cursor.index: value
+bool renderRollup(struct ResponseCursor &cursor)
+{
+	uint8_t level = cursor.option;
 
-			for(uint8_t i = 0; i < setting_sample_count; i++)
-				valuesum += *(valueptr++);
+	if(!cursor.part)
+	{
+		responseWrite("# uptime_s=");
+		responseWriteInteger(rollupSeconds());
+		responseWrite('\n');
+		return true;
+	}
 
-			double value = valuesum * metric.factor / setting_sample_count;
+	struct RollupBucket bucket;
+	int16_t age = rollupCount(level) - 1;
 
-			if(metric.type == LSB_COMPLEMENT || metric.type == LSB_UNSIGNED)
-				value /= (1 << 8);
+	for(; age >= 0; age--)
+	{
+		rollupBucket(level, age, 0, bucket);
 
-			message_buffer += preamble + metric.name;
-			message_buffer += ",phase=";
-			message_buffer.concat(metric.phases[index_phase]);
-			message_buffer += " value=" + String(value, metric.decimals) + "\n";
-		}
+		if(bucket.start_s >= cursor.from)
+			break;
 	}
 
-	const char *phases = "TABC";
+	if((age < 0) || (bucket.start_s > cursor.to))
+		return false;
 
-	for(uint8_t i = 0; i < 4; i++)
+	uint8_t index = cursor.index;
+
+	for(uint8_t index_metric = 0; index_metric < METRIC_COUNT; index_metric++)
 	{
-		message_buffer += preamble + "total_energy,phase=" + phases[i];
-		message_buffer += " value=";
+		const struct Metric &metric = metrics[index_metric];
+		uint8_t first = rollup_first[index_metric];
+
+		if((first == ROLLUP_NONE) || (index < first) || (index >= first + metric_layout.phase_count[index_metric]))
+			continue;
+
+		cursor.index++;
+
+		if(!rollupBucket(level, age, index, bucket))
+			return true;
+
+		char number_buffer[FORMAT_BUFFER_LENGTH];
 
-		if(setting_energy_total[i] < 0)
-			message_buffer += "-";
+		writePreamble();
+		responseWrite(metric.name);
+		responseWrite(",phase=");
+		responseWrite(metric.phases[index - first]);
+		responseWrite(",resolution=");
+		responseWrite(rollup_levels[level].name);
 
-		int64_t abs_total_energy = abs(setting_energy_total[i]);
-		message_buffer += int64_to_string(abs_total_energy / 10000) + ".";
+		formatValue(number_buffer, metric, bucket.avg, 1);
+		responseWrite(" avg=");
+		responseWrite(number_buffer);
 
-		String fractionalstr = String((uint16_t)(abs_total_energy % 10000));
+		formatValue(number_buffer, metric, bucket.min, 1);
+		responseWrite(",min=");
+		responseWrite(number_buffer);
 
-		for(uint8_t i = fractionalstr.length(); i < 4; i++)
-			message_buffer += "0";
+		formatValue(number_buffer, metric, bucket.max, 1);
+		responseWrite(",max=");
+		responseWrite(number_buffer);
 
-		message_buffer += fractionalstr + "\n";
+		responseWrite(",start_s=");
+		responseWriteInteger(bucket.start_s);
+		responseWrite("i\n");
+
+		return true;
 	}
 
-	httpServer.send(200, "text/plain; version=0.0.4", message_buffer);
-}
+	// all values of the bucket have been sent
+	cursor.from = (int64_t)bucket.start_s + 1;
+	cursor.index = 0;
 
-void handleMetrics()
-{
-	handleMetricsInternal(false);
+	return true;
 }
 
-void handleAllMetrics()
+void handleRollup()
 {
-	handleMetricsInternal(true);
+	struct ResponseCursor cursor = {};
+
+	cursor.option = 1;
+
+	if(halHttpHasArg("resolution"))
+	{
+		String resolution = halHttpArg("resolution");
+
+		for(cursor.option = 0; cursor.option < ROLLUP_LEVELS; cursor.option++)
+			if(resolution.equals(rollup_levels[cursor.option].name))
+				break;
+
+		if(cursor.option >= ROLLUP_LEVELS)
+		{
+			halHttpSend(400, "text/plain", "resolution must be 10s, 1m or 15m");
+			return;
+		}
+	}
+
+	cursor.from = 0;
+	cursor.to = rollupSeconds();
+
+	if((halHttpHasArg("from") && !parse_int64(cursor.from, halHttpArg("from").c_str())) ||
+		(halHttpHasArg("to") && !parse_int64(cursor.to, halHttpArg("to").c_str())))
+	{
+		halHttpSend(400, "text/plain", "from and to must be seconds since boot");
+		return;
+	}
+
+	responseSendParts(200, "text/plain; version=0.0.4", renderRollup, cursor);
 }
@@ -4,16 +4,90 @@
 void handleMetrics();
 void handleMetricsNew();
 void handleAllMetrics();
-void readMetrics();
+// avg / min / max history, args: resolution (10s, 1m, 15m), from / to (seconds since boot)
+void handleRollup();
+// startMetricsRead() begins a sample of the tiers in the bit mask tiers (1 << SampleTierId),
+// tick_time_us: time of the sample, tick_cycles: zero crossing count (0 for timer based sampling).
+// every call of continueMetricsRead() reads registers for about budget_us and returns true
+// once the sample has been stored in the buffers
+void startMetricsRead(uint8_t tiers, unsigned long tick_time_us, uint32_t tick_cycles);
+bool continueMetricsRead(unsigned long budget_us);
+// history, energy totals in FRAM, push, influx and MQTT of the last normal tier sample, call from loop() after
+// handleSampling()
+void handleMetricsCommit();
+bool metricsReadBusy();
 void initMetrics();
 void resetMetrics();
-void startMetricSocket();
+// drops the rendered /metrics, /allmetrics and /metricsnew bodies, call when their content changes outside of a sample
+void invalidateMetricsCache();
+// publishes the rest of the per-topic MQTT values of the last publish tick (see mqtt.h), call from loop()
+void handleMetricsMqtt();
+
+// raw averages of the main page values and energy totals for the influx push, and the record as
+// line protocol appended to lines (see influx.h)
+struct InfluxRecord;
+void captureInfluxRecord(struct InfluxRecord &record);
+void appendInfluxLines(String &lines, const struct InfluxRecord &record, uint32_t epoch);
+
+// metrics[] and the raw value of the latest sample of a metric, for the checks of the native build.
+// latestRaw() is 0 until metricSampled() is true: the tier of the metric has stored its first sample
+struct Metric;
+uint8_t metricCount();
+const struct Metric &metricAt(uint8_t index_metric);
+bool metricSampled(uint8_t index_metric);
+int32_t latestRaw(uint8_t index_metric, uint8_t index_phase);
+// ring buffer position of the latest sample of a tier, number of samples in its window, weight and raw value of the
+// sample at a position and the running weighted sum of a value, for the checks of the native build
+uint8_t latestIndex(uint8_t tier);
+uint8_t tierFilled(uint8_t tier);
+uint8_t storedWeight(uint8_t tier, uint8_t index);
+int32_t sampleRaw(uint8_t index_metric, uint8_t index_phase, uint8_t index);
+int64_t sampleSum(uint8_t index_metric, uint8_t index_phase);
 
 extern int64_t total_energy[];
 
 #define SAMPLE_COUNT_MAX 40
 #define SAMPLE_INTERVAL_MS 500
+// a sample after skipped ticks counts for the intervals it covers in the averages, up to this many
+#define SAMPLE_WEIGHT_MAX 4
+// time spent reading registers per loop() iteration and maximum number of registers per SPI burst. a slice runs
+// over the budget until the MSB and LSB registers of every value it started are read (see RegisterBlock.split)
+#define SAMPLE_SLICE_BUDGET_US 1000
+#define READ_SLICE_REGISTERS 8
+
+// every metric is sampled at the interval of its tier (see metrics[])
+enum SampleTierId {TIER_FAST = 0, TIER_NORMAL = 1, TIER_SLOW = 2, TIER_MINUTE = 3};
+#define TIER_COUNT 4
+#define TIER_MASK_ALL ((1 << TIER_COUNT) - 1)
+
+struct SampleTier
+{
+	uint16_t interval_ms;
+	// number of samples in the ring buffers of the tier
+	uint8_t depth;
+	// suffix of the per-tier /status values
+	const char *name;
+};
+
+extern const struct SampleTier sample_tiers[TIER_COUNT];
+
+// size of the static sample store and heap that was used by allocating every sample buffer separately
+extern const size_t sample_store_bytes;
+extern const size_t sample_store_heap_reclaimed;
+
+// capacity of the rendered /metrics and /metricsnew bodies that are kept for one sample tick. bodies that are larger
+// (long metric name or location tag) are rendered for every request. /allmetrics is rendered while it is sent
+// (see response.h), it is not cached: its metric lines and the harmonic lines would need about 15 kB
+#define CACHE_METRICS_LENGTH 1280
+#define CACHE_METRICSNEW_LENGTH 1024
+
+// format of the UDP push (setting_push_format)
+#define PUSH_FORMAT_TEXT 0
+#define PUSH_FORMAT_BINARY 1
+
 #define INFLUX_PREAMBLE String(setting_metric_name) + ",loc=" + setting_location_tag + ",name="
+// INFLUX_PREAMBLE through the response writer
+void writePreamble();
 
 extern unsigned long lastMetricReadTime;
 
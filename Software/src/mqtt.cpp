@@ -0,0 +1,410 @@
+#include "Arduino.h"
+#include "hal.h"
+#include "mqtt.h"
+#include "settings.h"
+
+// MQTT_OPENING: TCP handshake, MQTT_CONNECTING: waiting for the CONNACK
+enum MqttState {MQTT_DISABLED = 0, MQTT_DISCONNECTED = 1, MQTT_OPENING = 2, MQTT_CONNECTING = 3, MQTT_CONNECTED = 4};
+
+// control packet types (upper nibble of the fixed header)
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_PUBACK 0x40
+#define MQTT_PINGREQ 0xC0
+#define MQTT_PINGRESP 0xD0
+#define MQTT_DISCONNECT 0xE0
+
+// CONNECT flags: clean session, retained last will with QoS 0
+#define MQTT_CONNECT_FLAGS 0x26
+
+uint8_t mqtt_state = MQTT_DISABLED;
+
+uint8_t mqtt_buffer[MQTT_BUFFER_LENGTH];
+uint16_t mqtt_length = 0;
+
+char mqtt_status_topic[MQTT_TOPIC_LENGTH];
+
+unsigned long mqtt_state_ms = 0;
+unsigned long mqtt_next_attempt_ms = 0;
+unsigned long mqtt_backoff_ms = 0;
+unsigned long mqtt_last_sent_ms = 0;
+bool mqtt_ping_pending = false;
+unsigned long mqtt_ping_ms = 0;
+uint8_t mqtt_ticks = 0;
+
+// packet ids and send times of the QoS 1 messages in flight, oldest first
+uint16_t mqtt_packet_id = 0;
+uint16_t mqtt_inflight_ids[MQTT_INFLIGHT_MAX];
+unsigned long mqtt_inflight_ms[MQTT_INFLIGHT_MAX];
+uint8_t mqtt_inflight_count = 0;
+
+// received packet: fixed header, remaining length (decoded in steps of 7 bits) and the first bytes of the rest
+uint8_t mqtt_rx_header = 0;
+uint8_t mqtt_rx_stage = 0;
+uint32_t mqtt_rx_remaining = 0;
+uint8_t mqtt_rx_shift = 0;
+uint8_t mqtt_rx_body[2];
+uint8_t mqtt_rx_received = 0;
+
+uint32_t mqtt_connects = 0;
+uint32_t mqtt_messages_published = 0;
+uint32_t mqtt_messages_dropped = 0;
+uint32_t mqtt_messages_lost = 0;
+
+// closes the connection and schedules the next attempt
+void mqttFailed()
+{
+	halTcpClose();
+
+	mqtt_state = MQTT_DISCONNECTED;
+	mqtt_length = 0;
+	mqtt_ping_pending = false;
+	mqtt_messages_lost += mqtt_inflight_count;
+	mqtt_inflight_count = 0;
+	mqtt_rx_stage = 0;
+
+	mqtt_backoff_ms = mqtt_backoff_ms ? min(2 * mqtt_backoff_ms, (unsigned long)MQTT_BACKOFF_MAX_MS) : MQTT_BACKOFF_MIN_MS;
+	mqtt_next_attempt_ms = halMillis() + mqtt_backoff_ms;
+}
+
+// writes what the send buffer of the connection takes, the rest stays queued for the next call
+void mqttFlush()
+{
+	if(!mqtt_length)
+		return;
+
+	size_t written = halTcpWrite(mqtt_buffer, mqtt_length);
+
+	if(!written)
+		return;
+
+	mqtt_length -= written;
+	memmove(mqtt_buffer, mqtt_buffer + written, mqtt_length);
+	mqtt_last_sent_ms = halMillis();
+}
+
+// true if a packet with remaining bytes after the fixed header fits in the buffer, the queued packets are written
+// first if it does not
+bool mqttRoom(uint16_t remaining)
+{
+	uint16_t length = 1 + ((remaining < 128) ? 1 : 2) + remaining;
+
+	if(mqtt_length + length > MQTT_BUFFER_LENGTH)
+		mqttFlush();
+
+	return mqtt_length + length <= MQTT_BUFFER_LENGTH;
+}
+
+// starts a packet in the buffer, returns false if the packet can not be queued
+bool mqttBegin(uint8_t header, uint16_t remaining)
+{
+	if((mqtt_state == MQTT_DISCONNECTED) || (!mqttRoom(remaining)))
+		return false;
+
+	mqtt_buffer[mqtt_length++] = header;
+
+	if(remaining < 128)
+		mqtt_buffer[mqtt_length++] = remaining;
+	else
+	{
+		mqtt_buffer[mqtt_length++] = (remaining & 0x7F) | 0x80;
+		mqtt_buffer[mqtt_length++] = remaining >> 7;
+	}
+
+	return true;
+}
+
+void mqttWrite(const void *data, uint16_t length)
+{
+	memcpy(mqtt_buffer + mqtt_length, data, length);
+	mqtt_length += length;
+}
+
+void mqttWriteWord(uint16_t value)
+{
+	mqtt_buffer[mqtt_length++] = value >> 8;
+	mqtt_buffer[mqtt_length++] = value & 0xFF;
+}
+
+void mqttWriteString(const char *text)
+{
+	uint16_t length = strlen(text);
+
+	mqttWriteWord(length);
+	mqttWrite(text, length);
+}
+
+// starts the TCP handshake, the CONNECT follows in handleMqtt() once it has completed
+void mqttConnect()
+{
+	mqtt_connects++;
+	mqtt_state = MQTT_OPENING;
+	mqtt_state_ms = halMillis();
+	mqtt_length = 0;
+
+	if(!halTcpConnect(setting_mqtt_host, setting_mqtt_port))
+		mqttFailed();
+}
+
+void mqttSendConnect()
+{
+	mqtt_state = MQTT_CONNECTING;
+
+	const uint8_t variable_header[] = {0, 4, 'M', 'Q', 'T', 'T', 4, MQTT_CONNECT_FLAGS,
+		(uint8_t)(setting_mqtt_keepalive >> 8), (uint8_t)(setting_mqtt_keepalive & 0xFF)};
+
+	uint16_t remaining = sizeof(variable_header) + 2 + strlen(setting_wifi_hostname) + 2 + strlen(mqtt_status_topic) + 2 + strlen("offline");
+
+	if(!mqttBegin(MQTT_CONNECT, remaining))
+	{
+		mqttFailed();
+		return;
+	}
+
+	mqttWrite(variable_header, sizeof(variable_header));
+	mqttWriteString(setting_wifi_hostname);
+	mqttWriteString(mqtt_status_topic);
+	mqttWriteString("offline");
+
+	mqttFlush();
+}
+
+void configureMqtt()
+{
+	if(mqtt_state == MQTT_CONNECTED)
+	{
+		mqtt_length = 0;
+		if(mqttBegin(MQTT_DISCONNECT, 0))
+			mqttFlush();
+	}
+
+	halTcpClose();
+
+	snprintf(mqtt_status_topic, sizeof(mqtt_status_topic), "%s/%s/status", setting_metric_name, setting_location_tag);
+
+	mqtt_state = setting_mqtt_host[0] ? MQTT_DISCONNECTED : MQTT_DISABLED;
+	mqtt_length = 0;
+	mqtt_ping_pending = false;
+	mqtt_messages_lost += mqtt_inflight_count;
+	mqtt_inflight_count = 0;
+	mqtt_rx_stage = 0;
+	mqtt_backoff_ms = 0;
+	mqtt_next_attempt_ms = halMillis();
+}
+
+bool mqttConnected()
+{
+	return mqtt_state == MQTT_CONNECTED;
+}
+
+bool mqttTick()
+{
+	if(mqtt_state != MQTT_CONNECTED)
+		return false;
+
+	if(++mqtt_ticks < setting_mqtt_interval)
+		return false;
+
+	mqtt_ticks = 0;
+
+	return true;
+}
+
+bool mqttReady(uint16_t topic_length, uint16_t length)
+{
+	return (mqtt_state == MQTT_CONNECTED) && ((!setting_mqtt_qos) || (mqtt_inflight_count < setting_mqtt_inflight)) &&
+		mqttRoom(2 + topic_length + (setting_mqtt_qos ? 2 : 0) + length);
+}
+
+bool mqttPublish(const char *topic, const char *payload, uint16_t length, bool retain)
+{
+	uint8_t qos = setting_mqtt_qos;
+	uint16_t topic_length = strlen(topic);
+
+	if((!mqttReady(topic_length, length)) || (!mqttBegin(MQTT_PUBLISH | (qos << 1) | (retain ? 1 : 0), 2 + topic_length + (qos ? 2 : 0) + length)))
+	{
+		mqtt_messages_dropped++;
+		return false;
+	}
+
+	mqttWriteWord(topic_length);
+	mqttWrite(topic, topic_length);
+
+	if(qos)
+	{
+		// packet id 0 is not allowed
+		if(!++mqtt_packet_id)
+			mqtt_packet_id++;
+
+		mqttWriteWord(mqtt_packet_id);
+
+		mqtt_inflight_ids[mqtt_inflight_count] = mqtt_packet_id;
+		mqtt_inflight_ms[mqtt_inflight_count] = halMillis();
+		mqtt_inflight_count++;
+	}
+
+	mqttWrite(payload, length);
+	mqtt_messages_published++;
+
+	return true;
+}
+
+void mqttAcknowledged(uint16_t packet_id)
+{
+	for(uint8_t i = 0; i < mqtt_inflight_count; i++)
+	{
+		if(mqtt_inflight_ids[i] != packet_id)
+			continue;
+
+		mqtt_inflight_count--;
+		memmove(mqtt_inflight_ids + i, mqtt_inflight_ids + i + 1, (mqtt_inflight_count - i) * sizeof(mqtt_inflight_ids[0]));
+		memmove(mqtt_inflight_ms + i, mqtt_inflight_ms + i + 1, (mqtt_inflight_count - i) * sizeof(mqtt_inflight_ms[0]));
+		return;
+	}
+}
+
+// a complete packet has been received, only its first two bytes after the fixed header are kept
+void mqttReceived()
+{
+	switch(mqtt_rx_header & 0xF0)
+	{
+		case MQTT_CONNACK:
+			if((mqtt_state != MQTT_CONNECTING) || (mqtt_rx_received < 2) || mqtt_rx_body[1])
+			{
+				mqttFailed();
+				return;
+			}
+
+			mqtt_state = MQTT_CONNECTED;
+			mqtt_backoff_ms = 0;
+			mqtt_ticks = 0;
+
+			mqttPublish(mqtt_status_topic, "online", strlen("online"), true);
+			mqttFlush();
+			break;
+
+		case MQTT_PUBACK:
+			if(mqtt_rx_received >= 2)
+				mqttAcknowledged((mqtt_rx_body[0] << 8) | mqtt_rx_body[1]);
+			break;
+
+		case MQTT_PINGRESP:
+			mqtt_ping_pending = false;
+			break;
+	}
+}
+
+void mqttReceive()
+{
+	uint8_t data[32];
+	size_t length;
+
+	while((mqtt_state != MQTT_DISCONNECTED) && (length = halTcpRead(data, sizeof(data))))
+	{
+		for(size_t i = 0; (i < length) && (mqtt_state != MQTT_DISCONNECTED); i++)
+		{
+			uint8_t byte = data[i];
+
+			if(mqtt_rx_stage == 0)
+			{
+				mqtt_rx_header = byte;
+				mqtt_rx_remaining = 0;
+				mqtt_rx_shift = 0;
+				mqtt_rx_received = 0;
+				mqtt_rx_stage = 1;
+				continue;
+			}
+
+			if(mqtt_rx_stage == 1)
+			{
+				mqtt_rx_remaining |= (uint32_t)(byte & 0x7F) << mqtt_rx_shift;
+				mqtt_rx_shift += 7;
+
+				if(byte & 0x80)
+					continue;
+
+				mqtt_rx_stage = 2;
+			}
+			else
+			{
+				if(mqtt_rx_received < sizeof(mqtt_rx_body))
+					mqtt_rx_body[mqtt_rx_received++] = byte;
+
+				mqtt_rx_remaining--;
+			}
+
+			if(!mqtt_rx_remaining)
+			{
+				mqtt_rx_stage = 0;
+				mqttReceived();
+			}
+		}
+	}
+}
+
+void handleMqtt()
+{
+	if(mqtt_state == MQTT_DISABLED)
+		return;
+
+	unsigned long now = halMillis();
+
+	if(mqtt_state == MQTT_DISCONNECTED)
+	{
+		if((long)(now - mqtt_next_attempt_ms) >= 0)
+			mqttConnect();
+
+		return;
+	}
+
+	if(mqtt_state == MQTT_OPENING)
+	{
+		if(halTcpConnected())
+			mqttSendConnect();
+		else if((!halTcpConnecting()) || (now - mqtt_state_ms > MQTT_CONNECT_TIMEOUT_MS))
+			mqttFailed();
+
+		return;
+	}
+
+	if(!halTcpConnected())
+	{
+		mqttFailed();
+		return;
+	}
+
+	mqttReceive();
+	// the rest of packets that did not fit in the send buffer
+	mqttFlush();
+
+	unsigned long keepalive_ms = setting_mqtt_keepalive * 1000;
+
+	if(mqtt_state == MQTT_CONNECTING)
+	{
+		if(now - mqtt_state_ms > MQTT_CONNECT_TIMEOUT_MS)
+			mqttFailed();
+
+		return;
+	}
+
+	if(mqtt_state != MQTT_CONNECTED)
+		return;
+
+	// the broker answers within the keepalive time or the connection is considered broken
+	if((mqtt_ping_pending && (now - mqtt_ping_ms > keepalive_ms)) || (mqtt_inflight_count && (now - mqtt_inflight_ms[0] > keepalive_ms)))
+	{
+		mqttFailed();
+		return;
+	}
+
+	if((!mqtt_ping_pending) && (now - mqtt_last_sent_ms >= keepalive_ms / 2))
+	{
+		if(mqttBegin(MQTT_PINGREQ, 0))
+		{
+			mqtt_ping_pending = true;
+			mqtt_ping_ms = now;
+			mqttFlush();
+		}
+	}
+}
@@ -0,0 +1,54 @@
+#ifndef MQTT_h
+#define MQTT_h
+
+#include <stdint.h>
+
+// MQTT 3.1.1 publisher (no subscriptions) for the broker setting_mqtt_host:setting_mqtt_port. the client id is the
+// hostname, all topics start with <metric name>/<location tag>/. the retained topic status is "online" while the
+// meter is connected and "offline" (last will) otherwise. the packets of one sample tick are collected in one buffer
+// and written together, what the send buffer of the connection does not take is written from handleMqtt(). the
+// connection is set up in the background, failed connections are retried with exponential backoff.
+// QoS 1 messages are in flight until their PUBACK, no more than setting_mqtt_inflight are published at a time.
+// there is no RAM to keep copies, messages still in flight when the connection breaks are counted as lost
+// instead of being sent again (the influx spool is the gap-free record)
+
+// applies the broker settings, an open connection is closed
+void configureMqtt();
+// connection, keepalive and acknowledgements, call from loop()
+void handleMqtt();
+bool mqttConnected();
+// true every setting_mqtt_interval calls while connected, called once per sample of the normal tier
+bool mqttTick();
+// true if a PUBLISH with these topic and payload lengths can be queued now (connected, a QoS 1 message in flight
+// less than allowed, room in the buffer)
+bool mqttReady(uint16_t topic_length, uint16_t length);
+// queues a PUBLISH packet, returns false if it was dropped (see mqttReady())
+bool mqttPublish(const char *topic, const char *payload, uint16_t length, bool retain = false);
+// writes the queued packets
+void mqttFlush();
+
+// format of the published metrics (setting_mqtt_format): one JSON object on <prefix>metrics or one topic
+// <prefix><name>/<phase> per value. with QoS 1 the values of a tick do not fit in the in-flight window at once, the
+// rest is published as the broker acknowledges (handleMetricsMqtt()), values still waiting at the next tick are dropped
+#define MQTT_FORMAT_PACKED 0
+#define MQTT_FORMAT_TOPICS 1
+
+// one TCP segment
+#define MQTT_BUFFER_LENGTH 1460
+#define MQTT_TOPIC_LENGTH 96
+#define MQTT_INFLIGHT_MAX 8
+// samples per publish
+#define MQTT_INTERVAL_MAX 120
+
+#define MQTT_BACKOFF_MIN_MS 2000
+#define MQTT_BACKOFF_MAX_MS 120000
+// time for the TCP handshake and the CONNACK
+#define MQTT_CONNECT_TIMEOUT_MS 5000
+
+extern uint32_t mqtt_connects;
+extern uint32_t mqtt_messages_published;
+// not published (see mqttPublish) and QoS 1 messages that were never acknowledged
+extern uint32_t mqtt_messages_dropped;
+extern uint32_t mqtt_messages_lost;
+
+#endif
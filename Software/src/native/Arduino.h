@@ -0,0 +1,163 @@
+#ifndef NATIVE_ARDUINO_h
+#define NATIVE_ARDUINO_h
+
+// minimal stand-in for the parts of the Arduino core used by the portable sources,
+// only used by the native (host) build
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <cstdlib>
+#include <string>
+#include <algorithm>
+
+using std::abs;
+using std::min;
+using std::max;
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+// the host has no separate flash address space
+#define PROGMEM
+
+#define DEC 10
+#define HEX 16
+
+class String
+{
+public:
+	String() {}
+	String(const char *str) : data(str ? str : "") {}
+	String(const String &str) = default;
+	explicit String(char c) : data(1, c) {}
+	explicit String(unsigned char value, unsigned char base = 10) { fromUnsigned(value, base); }
+	explicit String(int value, unsigned char base = 10) { fromSigned(value, base); }
+	explicit String(unsigned int value, unsigned char base = 10) { fromUnsigned(value, base); }
+	explicit String(long value, unsigned char base = 10) { fromSigned(value, base); }
+	explicit String(unsigned long value, unsigned char base = 10) { fromUnsigned(value, base); }
+	explicit String(float value, unsigned char decimals = 2) { fromDouble(value, decimals); }
+	explicit String(double value, unsigned char decimals = 2) { fromDouble(value, decimals); }
+
+	String &operator=(const String &str) = default;
+
+	unsigned int length() const { return data.length(); }
+	const char *c_str() const { return data.c_str(); }
+	void reserve(unsigned int size) { data.reserve(size); }
+
+	void remove(unsigned int index) { if(index < data.length()) data.erase(index); }
+	void remove(unsigned int index, unsigned int count) { if(index < data.length()) data.erase(index, count); }
+
+	bool concat(const String &str) { data += str.data; return true; }
+	bool concat(const char *str) { data += str; return true; }
+	bool concat(char c) { data += c; return true; }
+
+	String &operator+=(const String &str) { data += str.data; return *this; }
+	String &operator+=(const char *str) { data += str; return *this; }
+	String &operator+=(char c) { data += c; return *this; }
+	String &operator+=(int value) { return *this += String(value); }
+	String &operator+=(unsigned int value) { return *this += String(value); }
+	String &operator+=(long value) { return *this += String(value); }
+	String &operator+=(unsigned long value) { return *this += String(value); }
+
+	char operator[](unsigned int index) const { return index < data.length() ? data[index] : 0; }
+
+	bool equals(const String &str) const { return data == str.data; }
+	bool equals(const char *str) const { return data == str; }
+	bool operator==(const String &str) const { return data == str.data; }
+	bool operator==(const char *str) const { return data == str; }
+
+	void getBytes(unsigned char *buffer, unsigned int size, unsigned int index = 0) const
+	{
+		if(!size || !buffer)
+			return;
+
+		if(index >= data.length())
+		{
+			buffer[0] = 0;
+			return;
+		}
+
+		unsigned int count = std::min(size - 1, (unsigned int)(data.length() - index));
+		memcpy(buffer, data.c_str() + index, count);
+		buffer[count] = 0;
+	}
+
+	long toInt() const { return atol(data.c_str()); }
+
+private:
+	std::string data;
+
+	void fromUnsigned(unsigned long value, unsigned char base)
+	{
+		char buffer[34];
+		char *pointer = buffer + sizeof(buffer) - 1;
+		*pointer = 0;
+
+		do
+		{
+			*(--pointer) = "0123456789abcdef"[value % base];
+			value /= base;
+		} while(value);
+
+		data = pointer;
+	}
+
+	void fromSigned(long value, unsigned char base)
+	{
+		if((value < 0) && (base == 10))
+		{
+			fromUnsigned(-(unsigned long)value, base);
+			data.insert(0, 1, '-');
+		}
+		else
+			fromUnsigned((unsigned long)value, base);
+	}
+
+	void fromDouble(double value, unsigned char decimals)
+	{
+		char buffer[64];
+		snprintf(buffer, sizeof(buffer), "%.*f", decimals, value);
+		data = buffer;
+	}
+};
+
+inline String operator+(const String &lhs, const String &rhs) { String result(lhs); result += rhs; return result; }
+inline String operator+(const String &lhs, const char *rhs) { String result(lhs); result += rhs; return result; }
+inline String operator+(const char *lhs, const String &rhs) { String result(lhs); result += rhs; return result; }
+inline String operator+(const String &lhs, char rhs) { String result(lhs); result += rhs; return result; }
+
+class IPAddress
+{
+public:
+	IPAddress() : bytes{0, 0, 0, 0} {}
+	IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : bytes{a, b, c, d} {}
+
+	uint8_t operator[](int index) const { return bytes[index]; }
+
+	bool fromString(const char *address)
+	{
+		unsigned int parts[4];
+		char tail;
+
+		if(sscanf(address, "%u.%u.%u.%u%c", parts, parts + 1, parts + 2, parts + 3, &tail) != 4)
+			return false;
+
+		for(uint8_t i = 0; i < 4; i++)
+		{
+			if(parts[i] > 255)
+				return false;
+			bytes[i] = parts[i];
+		}
+
+		return true;
+	}
+
+private:
+	uint8_t bytes[4];
+};
+
+#endif
@@ -0,0 +1,403 @@
+#include <math.h>
+
+#include "Arduino.h"
+#include "hal.h"
+#include "ATM90E36.h"
+#include "native.h"
+#include "atm90e36_sim.h"
+
+uint16_t sim_ideal_voltage_gain[3] = {13285, 13251, 13250};
+uint16_t sim_ideal_current_gain[3] = {20132, 20328, 20333};
+
+unsigned long sim_read_count = 0;
+unsigned long sim_write_count = 0;
+
+// configuration / calibration registers as written by the firmware
+static uint16_t sim_registers[0x100];
+
+static struct SimScenario sim_scenario;
+
+// energy in units of 0.1 Wh (0.1 CF with PL constant 1kWh = 1000CF), index 0 = total, 1-3 = phase A-C.
+// pending energy is returned and cleared by reading the energy registers, physical energy is never cleared
+static double sim_energy_pending_forward[4];
+static double sim_energy_pending_reverse[4];
+static double sim_energy_forward[4];
+static double sim_energy_reverse[4];
+static unsigned long sim_last_update_us = 0;
+
+// measurement registers 0xB0 - 0xFF, recalculated when the scenario or a gain changes
+static uint16_t sim_measurements[0x50];
+static bool sim_measurements_valid = false;
+
+#define SIM_MEASUREMENT(address) sim_measurements[(address) - PmeanT]
+
+// duration of a harmonic analysis started through DFT_CTRL
+#define SIM_DFT_DURATION_US 100000
+static bool sim_dft_running = false;
+static unsigned long sim_dft_start_us = 0;
+
+const struct SimScenario sim_scenario_balanced = {
+	{
+		{230.0, 10.0, 0.0, 18.2, 1.5, 8.0},
+		{230.0, 10.0, 120.0, 18.2, 1.5, 8.0},
+		{230.0, 10.0, 240.0, 18.2, 1.5, 8.0}
+	},
+	50.0, 35.0
+};
+
+const struct SimScenario sim_scenario_unbalanced = {
+	{
+		{231.4, 14.2, 0.0, 5.0, 1.8, 12.5},
+		{228.9, 3.1, 119.5, 35.0, 1.6, 25.0},
+		{233.0, 0.4, 240.3, 60.0, 1.7, 80.0}
+	},
+	49.98, 41.0
+};
+
+// phase C feeds power back into the grid (e.g. solar inverter)
+const struct SimScenario sim_scenario_export = {
+	{
+		{230.0, 4.0, 0.0, 10.0, 1.5, 10.0},
+		{230.0, 2.5, 120.0, 25.0, 1.5, 15.0},
+		{232.5, 12.0, 240.0, 178.0, 1.9, 4.0}
+	},
+	50.02, 38.0
+};
+
+const struct SimScenario sim_scenario_idle = {
+	{
+		{229.0, 0.0, 0.0, 0.0, 1.5, 0.0},
+		{229.0, 0.0, 120.0, 0.0, 1.5, 0.0},
+		{229.0, 0.0, 240.0, 0.0, 1.5, 0.0}
+	},
+	50.0, 30.0
+};
+
+static int32_t clampSigned16(double value)
+{
+	if(value > 32767)
+		return 32767;
+	if(value < -32768)
+		return -32768;
+	return (int32_t)lround(value);
+}
+
+static uint16_t clampUnsigned16(double value)
+{
+	if(value > 65535)
+		return 65535;
+	if(value < 0)
+		return 0;
+	return (uint16_t)lround(value);
+}
+
+// split a value into the MSB register and the upper byte of the LSB register
+static void encodeLSB(double value, bool is_signed, uint16_t &msb, uint16_t &lsb)
+{
+	double limit = is_signed ? 32768.0 * 256 : 65536.0 * 256;
+	double fixed = round(value * 256);
+
+	if(fixed >= limit)
+		fixed = limit - 1;
+	if(fixed < (is_signed ? -limit : 0))
+		fixed = is_signed ? -limit : 0;
+
+	int32_t fixed_int = (int32_t)fixed;
+
+	msb = (uint16_t)(fixed_int >> 8);
+	lsb = (uint16_t)((fixed_int & 0xFF) << 8);
+}
+
+static double voltageGain(uint8_t phase)
+{
+	return (double)sim_registers[UgainA + 4 * phase] / sim_ideal_voltage_gain[phase];
+}
+
+static double currentGain(uint8_t phase)
+{
+	return (double)sim_registers[IgainA + 4 * phase] / sim_ideal_current_gain[phase];
+}
+
+// power gain registers are signed, gain = 1 + GainX / 2^15
+static double powerGain(uint8_t phase)
+{
+	return 1.0 + (int16_t)sim_registers[GainA + 2 * phase] / 32768.0;
+}
+
+static double activePower(uint8_t phase)
+{
+	const struct SimPhase &p = sim_scenario.phases[phase];
+	return p.voltage * p.current * cos(p.current_angle * M_PI / 180) * powerGain(phase);
+}
+
+static double reactivePower(uint8_t phase)
+{
+	const struct SimPhase &p = sim_scenario.phases[phase];
+	return p.voltage * p.current * sin(p.current_angle * M_PI / 180) * powerGain(phase);
+}
+
+static void simUpdateMeasurements()
+{
+	double power[4] = {0}, power_reactive[4] = {0}, power_apparent[4] = {0};
+	double neutral_re = 0, neutral_im = 0;
+
+	for(uint8_t phase = 0; phase < 3; phase++)
+	{
+		const struct SimPhase &p = sim_scenario.phases[phase];
+
+		power[phase + 1] = activePower(phase);
+		power_reactive[phase + 1] = reactivePower(phase);
+		power_apparent[phase + 1] = p.voltage * p.current * powerGain(phase);
+
+		power[0] += power[phase + 1];
+		power_reactive[0] += power_reactive[phase + 1];
+		power_apparent[0] += power_apparent[phase + 1];
+
+		double angle = (p.voltage_angle + p.current_angle) * M_PI / 180;
+		neutral_re += p.current * cos(angle);
+		neutral_im += p.current * sin(angle);
+	}
+
+	// mean power registers: 1 W / var / VA per MSB for the phases, 4 W per MSB for the total
+	for(uint8_t i = 0; i < 4; i++)
+	{
+		double scale = (i == 0) ? 1. / 4 : 1.;
+
+		encodeLSB(power[i] * scale, true, SIM_MEASUREMENT(PmeanT + i), SIM_MEASUREMENT(PmeanTLSB + i));
+		encodeLSB(power_reactive[i] * scale, true, SIM_MEASUREMENT(QmeanT + i), SIM_MEASUREMENT(QmeanTLSB + i));
+		encodeLSB(power_apparent[i] * scale, true, SIM_MEASUREMENT(SmeanT + i), SIM_MEASUREMENT(SAmeanTLSB + i));
+
+		double power_factor = power_apparent[i] > 0 ? power[i] / power_apparent[i] : 0;
+		SIM_MEASUREMENT(PFmeanT + i) = (uint16_t)clampSigned16(power_factor * 1000);
+
+		// fundamental power, harmonics are not modelled
+		encodeLSB(power[i] * scale, true, SIM_MEASUREMENT(PmeanTF + i), SIM_MEASUREMENT(PmeanTFLSB + i));
+		SIM_MEASUREMENT(PmeanTH + i) = 0;
+		SIM_MEASUREMENT(PmeanTHLSB + i) = 0;
+	}
+
+	for(uint8_t phase = 0; phase < 3; phase++)
+	{
+		const struct SimPhase &p = sim_scenario.phases[phase];
+
+		// 0.01 V and 1 mA per MSB
+		encodeLSB(p.voltage * voltageGain(phase) * 100, false, SIM_MEASUREMENT(UrmsA + phase), SIM_MEASUREMENT(UrmsALSB + phase));
+		encodeLSB(p.current * currentGain(phase) * 1000, false, SIM_MEASUREMENT(IrmsA + phase), SIM_MEASUREMENT(IrmsALSB + phase));
+
+		SIM_MEASUREMENT(THDNUA + phase) = clampUnsigned16(p.thdn_voltage * 100);
+		SIM_MEASUREMENT(THDNIA + phase) = clampUnsigned16(p.thdn_current * 100);
+		SIM_MEASUREMENT(PAngleA + phase) = (uint16_t)clampSigned16(p.current_angle * 10);
+		SIM_MEASUREMENT(UangleA + phase) = (uint16_t)clampSigned16(p.voltage_angle * 10);
+	}
+
+	SIM_MEASUREMENT(IrmsN0) = clampUnsigned16(sqrt(neutral_re * neutral_re + neutral_im * neutral_im) * 1000);
+	SIM_MEASUREMENT(IrmsN1) = SIM_MEASUREMENT(IrmsN0);
+	SIM_MEASUREMENT(Freq) = clampUnsigned16(sim_scenario.frequency * 100);
+	SIM_MEASUREMENT(Temp) = (uint16_t)clampSigned16(sim_scenario.temperature);
+
+	sim_measurements_valid = true;
+}
+
+// harmonic ratio register (0.01 %) of the channel starting at AI_HR2 + 0x20 * channel.
+// the distortion is spread over the odd harmonics with amplitudes falling with 1 / order,
+// scaled so that the total equals the THD+N of the scenario
+static uint16_t simHarmonicRatio(uint8_t channel, uint8_t order)
+{
+	// channel order of the ratio registers: current A, B, C, voltage A, B, C
+	const struct SimPhase &p = sim_scenario.phases[channel % 3];
+	double thd = (channel < 3) ? p.thdn_current : p.thdn_voltage;
+
+	if(!(order & 1))
+		return 0;
+
+	double norm = 0;
+	for(uint8_t n = 3; n <= 32; n += 2)
+		norm += 1.0 / (n * n);
+
+	return clampUnsigned16(thd / order / sqrt(norm) * 100);
+}
+
+// integrate active power since the last call into the energy accumulators
+static void simUpdateEnergy()
+{
+	unsigned long now = halMicros();
+	double hours = (now - sim_last_update_us) / 3600e6;
+	sim_last_update_us = now;
+
+	for(uint8_t phase = 0; phase < 3; phase++)
+	{
+		// 0.1 Wh per count
+		double energy = activePower(phase) * hours * 10;
+
+		if(energy >= 0)
+		{
+			sim_energy_pending_forward[phase + 1] += energy;
+			sim_energy_pending_forward[0] += energy;
+			sim_energy_forward[phase + 1] += energy;
+			sim_energy_forward[0] += energy;
+		}
+		else
+		{
+			sim_energy_pending_reverse[phase + 1] -= energy;
+			sim_energy_pending_reverse[0] -= energy;
+			sim_energy_reverse[phase + 1] -= energy;
+			sim_energy_reverse[0] -= energy;
+		}
+	}
+}
+
+// energy registers return the whole counts accumulated since the last read and keep the fraction
+static uint16_t readEnergy(double &pending)
+{
+	double counts = floor(pending);
+
+	if(counts > 65535)
+		counts = 65535;
+
+	pending -= counts;
+
+	return (uint16_t)counts;
+}
+
+static void simReset()
+{
+	memset(sim_registers, 0, sizeof(sim_registers));
+	memset(sim_energy_pending_forward, 0, sizeof(sim_energy_pending_forward));
+	memset(sim_energy_pending_reverse, 0, sizeof(sim_energy_pending_reverse));
+
+	sim_last_update_us = halMicros();
+	sim_measurements_valid = false;
+	sim_dft_running = false;
+}
+
+void simInit()
+{
+	memset(sim_energy_forward, 0, sizeof(sim_energy_forward));
+	memset(sim_energy_reverse, 0, sizeof(sim_energy_reverse));
+
+	simReset();
+	simLoadScenario("balanced");
+
+	native_spi_read = simRead;
+	native_spi_write = simWrite;
+}
+
+void simSetScenario(const struct SimScenario &scenario)
+{
+	// energy up to now is accumulated with the old scenario
+	simUpdateEnergy();
+
+	sim_scenario = scenario;
+	sim_measurements_valid = false;
+}
+
+bool simLoadScenario(const char *name)
+{
+	if(!strcmp(name, "balanced"))
+		simSetScenario(sim_scenario_balanced);
+	else if(!strcmp(name, "unbalanced"))
+		simSetScenario(sim_scenario_unbalanced);
+	else if(!strcmp(name, "export"))
+		simSetScenario(sim_scenario_export);
+	else if(!strcmp(name, "idle"))
+		simSetScenario(sim_scenario_idle);
+	else
+		return false;
+
+	return true;
+}
+
+const struct SimScenario &simGetScenario()
+{
+	return sim_scenario;
+}
+
+uint16_t simRead(uint16_t address)
+{
+	sim_read_count++;
+
+	if(address == DFT_CTRL)
+	{
+		if(sim_dft_running && ((halMicros() - sim_dft_start_us) >= SIM_DFT_DURATION_US))
+			sim_dft_running = false;
+
+		return sim_dft_running ? 1 : 0;
+	}
+
+	if((address >= AI_HR2) && (address < AI_FUND))
+	{
+		uint8_t channel = (address - AI_HR2) / 0x20;
+		uint8_t index = (address - AI_HR2) % 0x20;
+
+		if(index == 0x1F)
+			return clampUnsigned16(((channel < 3) ? sim_scenario.phases[channel % 3].thdn_current : sim_scenario.phases[channel % 3].thdn_voltage) * 100);
+
+		return simHarmonicRatio(channel, index + 2);
+	}
+
+	if(address >= 0x100)
+		return 0;
+
+	if((address >= APenergyT) && (address <= ANenergyC))
+	{
+		simUpdateEnergy();
+
+		if(address <= APenergyC)
+			return readEnergy(sim_energy_pending_forward[address - APenergyT]);
+		else
+			return readEnergy(sim_energy_pending_reverse[address - ANenergyT]);
+	}
+
+	if(address >= PmeanT)
+	{
+		if(!sim_measurements_valid)
+			simUpdateMeasurements();
+
+		return SIM_MEASUREMENT(address);
+	}
+
+	if(address == LastSPIData)
+		return 0;
+
+	return sim_registers[address];
+}
+
+void simWrite(uint16_t address, uint16_t value)
+{
+	sim_write_count++;
+
+	if((address == DFT_CTRL) && (value & 1))
+	{
+		sim_dft_running = true;
+		sim_dft_start_us = halMicros();
+		return;
+	}
+
+	if(address >= 0x100)
+		return;
+
+	if((address == SoftReset) && (value == 0x789A))
+	{
+		simReset();
+		return;
+	}
+
+	// only configuration and calibration registers are writable
+	if(address >= APenergyT)
+		return;
+
+	sim_registers[address] = value;
+	sim_measurements_valid = false;
+}
+
+double simEnergyForward(uint8_t phase)
+{
+	simUpdateEnergy();
+	return sim_energy_forward[phase];
+}
+
+double simEnergyReverse(uint8_t phase)
+{
+	simUpdateEnergy();
+	return sim_energy_reverse[phase];
+}
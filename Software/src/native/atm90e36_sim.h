@@ -0,0 +1,53 @@
+#ifndef ATM90E36_SIM_h
+#define ATM90E36_SIM_h
+
+#include "Arduino.h"
+
+// behavioural model of the ATM90E36, answers the register map in ATM90E36.h
+// through the fake SPI bus of the native build
+
+struct SimPhase
+{
+	// physical rms voltage (V) and current (A)
+	double voltage;
+	double current;
+	// angle of the voltage relative to phase A and of the current relative to its voltage (degrees)
+	double voltage_angle;
+	double current_angle;
+	// total harmonic distortion + noise (%)
+	double thdn_voltage;
+	double thdn_current;
+};
+
+struct SimScenario
+{
+	struct SimPhase phases[3];
+	double frequency;
+	double temperature;
+};
+
+// gains at which the measured rms values equal the physical values,
+// the measured values scale linearly with the programmed UgainX / IgainX
+extern uint16_t sim_ideal_voltage_gain[3];
+extern uint16_t sim_ideal_current_gain[3];
+
+// number of register reads / writes since startup
+extern unsigned long sim_read_count;
+extern unsigned long sim_write_count;
+
+// connect the simulator to the fake SPI bus and apply the power-on state
+void simInit();
+void simSetScenario(const struct SimScenario &scenario);
+// built-in scenarios: balanced, unbalanced, export, idle. returns false for unknown names
+bool simLoadScenario(const char *name);
+const struct SimScenario &simGetScenario();
+
+uint16_t simRead(uint16_t address);
+void simWrite(uint16_t address, uint16_t value);
+
+// physical energy (in units of 0.1 Wh) accumulated since simInit(), for comparison with setting_energy_total.
+// index 0 = total, 1-3 = phase A-C
+double simEnergyForward(uint8_t phase);
+double simEnergyReverse(uint8_t phase);
+
+#endif
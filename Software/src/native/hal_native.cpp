@@ -0,0 +1,525 @@
+#include <chrono>
+#include <ctime>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "Arduino.h"
+#include "hal.h"
+#include "native.h"
+
+/* CLOCK */
+
+static const std::chrono::steady_clock::time_point native_start_time = std::chrono::steady_clock::now();
+static unsigned long native_time_offset_us = 0;
+
+void nativeAdvanceTime(unsigned long us)
+{
+	native_time_offset_us += us;
+}
+
+unsigned long halMicros()
+{
+	auto elapsed = std::chrono::steady_clock::now() - native_start_time;
+	return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() + native_time_offset_us;
+}
+
+unsigned long halMillis()
+{
+	return halMicros() / 1000;
+}
+
+void halDelay(unsigned long ms)
+{
+	nativeAdvanceTime(ms * 1000);
+}
+
+void halDelayMicroseconds(unsigned int us)
+{
+	nativeAdvanceTime(us);
+}
+
+/* ATM90E36 SPI BUS */
+
+uint16_t native_registers[0x400];
+
+static uint16_t nativeRegisterRead(uint16_t address)
+{
+	return native_registers[address & 0x3FF];
+}
+
+static void nativeRegisterWrite(uint16_t address, uint16_t value)
+{
+	native_registers[address & 0x3FF] = value;
+}
+
+uint16_t (*native_spi_read)(uint16_t address) = nativeRegisterRead;
+void (*native_spi_write)(uint16_t address, uint16_t value) = nativeRegisterWrite;
+
+// the first word after chip select is the command (bit 15 = read, bits 0-9 = address),
+// every following word reads or writes one register with auto-incremented address
+static bool spi_selected = false;
+static bool spi_command_received = false;
+static bool spi_read = false;
+static uint16_t spi_address = 0;
+
+void halSpiInit()
+{
+}
+
+void halSpiSelect()
+{
+	spi_selected = true;
+	spi_command_received = false;
+}
+
+void halSpiDeselect()
+{
+	spi_selected = false;
+}
+
+uint16_t halSpiTransfer16(uint16_t data)
+{
+	if(!spi_selected)
+		return 0xFFFF;
+
+	if(!spi_command_received)
+	{
+		spi_command_received = true;
+		spi_read = data & (1 << 15);
+		spi_address = data & 0x3FF;
+		return 0xFFFF;
+	}
+
+	uint16_t value = 0xFFFF;
+
+	if(spi_read)
+		value = native_spi_read(spi_address);
+	else
+		native_spi_write(spi_address, data);
+
+	spi_address = (spi_address + 1) & 0x3FF;
+
+	return value;
+}
+
+/* FRAM I2C BUS */
+
+// starts out zeroed: strings fall back to their defaults, integer settings (gains, energy) load as zero
+uint8_t native_fram[NATIVE_FRAM_SIZE];
+
+static uint16_t fram_pointer = 0;
+static uint8_t fram_write_count = 0;
+
+void halI2cInit()
+{
+}
+
+void halI2cBeginWrite(uint8_t device)
+{
+	fram_write_count = 0;
+}
+
+void halI2cWrite(const uint8_t *data, uint8_t length)
+{
+	// the first two bytes set the address pointer, further bytes are written to memory
+	while(length--)
+	{
+		if(fram_write_count == 0)
+			fram_pointer = (*data) << 8;
+		else if(fram_write_count == 1)
+			fram_pointer |= *data;
+		else
+		{
+			native_fram[fram_pointer % NATIVE_FRAM_SIZE] = *data;
+			fram_pointer++;
+		}
+
+		data++;
+
+		if(fram_write_count < 2)
+			fram_write_count++;
+	}
+}
+
+void halI2cEndWrite(bool stop)
+{
+}
+
+uint8_t halI2cRead(uint8_t device, uint8_t *data, uint8_t length)
+{
+	for(uint8_t i = 0; i < length; i++)
+		data[i] = native_fram[(fram_pointer++) % NATIVE_FRAM_SIZE];
+
+	return length;
+}
+
+/* ZERO CROSSING INPUT */
+
+static bool zx_enabled = false;
+static uint32_t zx_count = 0;
+static unsigned long zx_time_us = 0;
+
+void halZeroCrossingBegin(int8_t pin)
+{
+	zx_enabled = pin >= 0;
+	zx_count = 0;
+}
+
+void halZeroCrossingRead(uint32_t &count, unsigned long &time_us)
+{
+	count = zx_count;
+	time_us = zx_time_us;
+}
+
+void nativeZeroCrossing()
+{
+	if(!zx_enabled)
+		return;
+
+	zx_time_us = halMicros();
+	zx_count++;
+}
+
+/* HTTP SERVER */
+
+std::map<std::string, std::string> native_http_args;
+NativeHttpResponse native_http_response;
+std::map<std::string, void (*)()> native_http_routes;
+bool native_restart_requested = false;
+
+void halHttpOn(const char *path, uint8_t method, void (*handler)())
+{
+	native_http_routes[std::string((method == HAL_HTTP_POST) ? "POST " : "GET ") + path] = handler;
+}
+
+void halHttpOnUpdate(const char *path, const char *username, const char *password)
+{
+}
+
+void halHttpBegin()
+{
+}
+
+void halHttpHandle()
+{
+}
+
+void halRestart()
+{
+	native_restart_requested = true;
+}
+
+void halHttpSend(int code, const char *content_type, const String &content)
+{
+	native_http_response.code = code;
+	native_http_response.content_type = content_type;
+	native_http_response.content = content.c_str();
+}
+
+void halHttpSendHeader(const char *name, const String &value)
+{
+	native_http_response.headers[name] = value.c_str();
+}
+
+bool halHttpHasArg(const char *name)
+{
+	return native_http_args.count(name) > 0;
+}
+
+String halHttpArg(const char *name)
+{
+	auto arg = native_http_args.find(name);
+
+	if(arg == native_http_args.end())
+		return String();
+
+	return String(arg->second.c_str());
+}
+
+void halHttpBeginContent(int code, const char *content_type, size_t length)
+{
+	native_http_response.code = code;
+	native_http_response.content_type = content_type;
+	native_http_response.content.clear();
+
+	if(length != HAL_HTTP_LENGTH_UNKNOWN)
+		native_http_response.content.reserve(length);
+}
+
+void halHttpSendContent(const char *data, size_t length)
+{
+	native_http_response.content.append(data, length);
+}
+
+void halHttpEndContent()
+{
+}
+
+void halHttpSendFill(int code, const char *content_type, HalHttpFill fill, void *context, void (*done)(void *context))
+{
+	char buffer[NATIVE_HTTP_FILL_LENGTH];
+	size_t length;
+
+	native_http_response.code = code;
+	native_http_response.content_type = content_type;
+	native_http_response.content.clear();
+
+	// the whole body right away, in pieces of the size the TCP stack of the meter typically asks for
+	while((length = fill(context, buffer, sizeof(buffer))))
+		native_http_response.content.append(buffer, length);
+
+	done(context);
+}
+
+/* UDP */
+
+unsigned long native_udp_packets = 0;
+unsigned long native_udp_bytes = 0;
+std::string native_udp_last;
+
+void halHttpSendStatic(int code, const char *content_type, const uint8_t *gzip_data, size_t length)
+{
+	native_http_response.code = code;
+	native_http_response.content_type = content_type;
+	native_http_response.headers["Content-Encoding"] = "gzip";
+	native_http_response.content.assign((const char*)gzip_data, length);
+}
+
+void halUdpBegin(uint16_t port)
+{
+}
+
+bool halUdpSend(const uint8_t address[4], uint16_t port, const char *data, size_t length)
+{
+	native_udp_packets++;
+	native_udp_bytes += length;
+	native_udp_last.assign(data, length);
+
+	return true;
+}
+
+/* HTTP CLIENT */
+
+unsigned long native_http_posts = 0;
+static int native_http_result = HAL_HTTP_POST_PENDING;
+
+// wait until the socket is ready for events, false on timeout
+static bool nativeSocketWait(int socket_fd, short events)
+{
+	struct pollfd poll_fd = {socket_fd, events, 0};
+
+	return poll(&poll_fd, 1, HAL_HTTP_POST_TIMEOUT_MS) == 1;
+}
+
+// plain HTTP/1.0 request over a TCP socket, enough for a local stand-in server
+static int nativeHttpPost(const char *host, uint16_t port, const char *path, const char *content_type, const char *body, size_t length)
+{
+	struct addrinfo hints = {};
+	struct addrinfo *address;
+	char port_text[8];
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(port_text, sizeof(port_text), "%u", port);
+
+	if(getaddrinfo(host, port_text, &hints, &address))
+		return -1;
+
+	int socket_fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+
+	if((socket_fd < 0) || connect(socket_fd, address->ai_addr, address->ai_addrlen))
+	{
+		if(socket_fd >= 0)
+			close(socket_fd);
+		freeaddrinfo(address);
+		return -1;
+	}
+
+	freeaddrinfo(address);
+
+	std::string request = std::string("POST ") + path + " HTTP/1.0\r\nHost: " + host + "\r\nContent-Type: " + content_type +
+		"\r\nContent-Length: " + std::to_string(length) + "\r\nConnection: close\r\n\r\n";
+	request.append(body, length);
+
+	size_t sent = 0;
+
+	while(sent < request.length())
+	{
+		ssize_t result = send(socket_fd, request.data() + sent, request.length() - sent, MSG_NOSIGNAL);
+
+		if(result <= 0)
+		{
+			close(socket_fd);
+			return -1;
+		}
+
+		sent += result;
+	}
+
+	// only the status line is needed: "HTTP/1.x 204 ..."
+	char status[32] = {};
+	size_t received = 0;
+
+	while((received < sizeof(status) - 1) && nativeSocketWait(socket_fd, POLLIN))
+	{
+		ssize_t result = recv(socket_fd, status + received, sizeof(status) - 1 - received, 0);
+
+		if(result <= 0)
+			break;
+
+		received += result;
+	}
+
+	close(socket_fd);
+
+	const char *code = strchr(status, ' ');
+
+	return code ? atoi(code + 1) : -1;
+}
+
+// the exchange runs right away, its result is reported from the next halHttpPostResult() call like on the device
+bool halHttpPostBegin(const char *host, uint16_t port, const char *path, const char *content_type, const char *body, size_t length)
+{
+	native_http_posts++;
+	native_http_result = nativeHttpPost(host, port, path, content_type, body, length);
+
+	return true;
+}
+
+int halHttpPostResult()
+{
+	return native_http_result;
+}
+
+/* TCP CLIENT */
+
+static int tcp_socket = -1;
+// connect() of a non-blocking socket is running
+static bool tcp_connecting = false;
+
+bool halTcpConnect(const char *host, uint16_t port)
+{
+	halTcpClose();
+
+	struct addrinfo hints = {};
+	struct addrinfo *address;
+	char port_text[8];
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(port_text, sizeof(port_text), "%u", port);
+
+	if(getaddrinfo(host, port_text, &hints, &address))
+		return false;
+
+	// the name lookup blocks, the handshake does not
+	tcp_socket = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+
+	if(tcp_socket >= 0)
+	{
+		fcntl(tcp_socket, F_SETFL, fcntl(tcp_socket, F_GETFL) | O_NONBLOCK);
+
+		if(!connect(tcp_socket, address->ai_addr, address->ai_addrlen))
+			tcp_connecting = false;
+		else if(errno == EINPROGRESS)
+			tcp_connecting = true;
+		else
+			halTcpClose();
+	}
+
+	freeaddrinfo(address);
+
+	return tcp_socket >= 0;
+}
+
+bool halTcpConnecting()
+{
+	if(!tcp_connecting)
+		return false;
+
+	struct pollfd poll_fd = {tcp_socket, POLLOUT, 0};
+
+	if(poll(&poll_fd, 1, 0) != 1)
+		return true;
+
+	int error = 0;
+	socklen_t error_length = sizeof(error);
+
+	tcp_connecting = false;
+
+	if(getsockopt(tcp_socket, SOL_SOCKET, SO_ERROR, &error, &error_length) || error)
+		halTcpClose();
+
+	return false;
+}
+
+bool halTcpConnected()
+{
+	if(halTcpConnecting() || (tcp_socket < 0))
+		return false;
+
+	// an orderly shutdown by the peer reads as 0 bytes
+	char byte;
+	ssize_t result = recv(tcp_socket, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+
+	if((result == 0) || ((result < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK)))
+	{
+		halTcpClose();
+		return false;
+	}
+
+	return true;
+}
+
+size_t halTcpWrite(const uint8_t *data, size_t length)
+{
+	if(tcp_socket < 0)
+		return 0;
+
+	ssize_t result = send(tcp_socket, data, length, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+	return (result > 0) ? result : 0;
+}
+
+size_t halTcpRead(uint8_t *data, size_t length)
+{
+	if(tcp_socket < 0)
+		return 0;
+
+	ssize_t result = recv(tcp_socket, data, length, MSG_DONTWAIT);
+
+	return (result > 0) ? result : 0;
+}
+
+void halTcpClose()
+{
+	if(tcp_socket >= 0)
+		close(tcp_socket);
+
+	tcp_socket = -1;
+	tcp_connecting = false;
+}
+
+/* WALL CLOCK */
+
+unsigned long native_epoch_sync_ms = 0;
+
+void halTimeBegin()
+{
+}
+
+uint32_t halEpochSeconds()
+{
+	// follows the emulated clock, so records taken in a fast emulated run get distinct times
+	static const uint32_t epoch_start = time(NULL);
+
+	if(halMillis() < native_epoch_sync_ms)
+		return 0;
+
+	return epoch_start + halMillis() / 1000;
+}
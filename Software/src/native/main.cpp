@@ -0,0 +1,700 @@
+#include "Arduino.h"
+#include "hal.h"
+#include "native.h"
+#include "atm90e36_sim.h"
+
+#include "metrics.h"
+#include "readplan.h"
+#include "ATM90E36.h"
+#include "fram.h"
+#include "settings.h"
+#include "globals.h"
+#include "sampler.h"
+#include "harmonics.h"
+#include "format.h"
+#include "response.h"
+#include "history.h"
+#include "influx.h"
+#include "mqtt.h"
+#include "histogram.h"
+
+// host build of the sampling and formatting code: runs initATM90E36(), handleSampling()
+// and the metrics handlers against the ATM90E36 simulator and the fake back-ends
+//
+// usage: program [ticks] [scenario] [influx port] [mqtt port] [mqtt format] [mqtt qos]
+//        program decode | readplan | stall | harmonics | settings
+// scenario is one of balanced (default), unbalanced, export, idle.
+// with an influx port the records are posted to 127.0.0.1:port (see influx_standin.py),
+// with an mqtt port the metrics are published to a broker on 127.0.0.1:port (e.g. mosquitto). 0 skips a port.
+// decode compares the decoded samples with the per-register decode loop for random register contents, readplan
+// compares the samples of every tier with reading the registers of every value one by one from the simulator (also
+// with a new measurement after every read slice), stall checks the missed ticks, sample weights and running sums
+// after a blocked loop(), harmonics compares the /allmetrics harmonic lines with known DFT results, settings checks
+// that a blank FRAM block means timer sampling (zxp is stored as pin + 1) and that zxp survives a reload. the exit
+// code of the checks is 1 if a value differs
+
+// emulated time between two loop() iterations
+#define NATIVE_LOOP_STEP_MS 10
+
+// number of clients that scrape every metrics page once per tick
+#define NATIVE_SCRAPERS 3
+
+// number of register images decoded by checkDecoders()
+#define NATIVE_DECODE_IMAGES 200
+
+// number of values formatted by benchmarkFormatting()
+#define NATIVE_FORMAT_COUNT 100000
+
+// loop() is blocked for this long by checkStall(), a whole number of fast tier intervals and part of a normal tier interval
+#define NATIVE_STALL_MS 1300
+// normal tier samples averaged during checkStall()
+#define NATIVE_STALL_SAMPLE_COUNT 10
+
+// influx records are taken before the emulated clock synchronizes after this time
+#define NATIVE_EPOCH_SYNC_MS 60000
+
+// store a setting through the /settings POST handler, like a user would
+static void postSetting(const char *id, const char *value)
+{
+	native_http_args.clear();
+	native_http_args["id"] = id;
+	native_http_args["value"] = value;
+	native_http_args["backurl"] = "/settings";
+
+	handleSettingsPost();
+	handleSettings();
+
+	if(native_http_response.code != 303)
+		printf("setting %s failed: %s\n", id, native_http_response.content.c_str());
+}
+
+static void postSetting(const char *id, long value)
+{
+	postSetting(id, String(value).c_str());
+}
+
+// register contents of checkDecoders(), answered instead of the simulator
+static uint16_t decode_image[0x100];
+
+static uint16_t decodeImageRead(uint16_t address)
+{
+	return decode_image[address & 0xFF];
+}
+
+// the decode loop of every metric and phase that the read plan replaced, the reference of checkDecoders() and
+// checkReadPlan(). msb and lsb are the contents of the metric's register and of the register REGISTER_LSB_OFFSET above
+static int32_t legacyDecode(const struct Metric &metric, uint16_t msb, uint16_t lsb)
+{
+	if(metric.type == LSB_COMPLEMENT)
+	{
+		uint32_t val = msb;
+
+		if(val & 0x8000)
+			val |= 0xFF0000;
+
+		val = (val << 8) + (lsb >> 8);
+
+		return (int32_t)val;
+	}
+	else if(metric.type == LSB_UNSIGNED)
+	{
+		int32_t value = msb;
+
+		return (value << 8) + (lsb >> 8);
+	}
+	else if(metric.type == NOLSB_SIGNED)
+		return (signed short)msb;
+
+	return msb;
+}
+
+// samples of all tiers for register images of edge values and random contents, read through the read plan bursts
+// and decoders, must equal the per-register decode of the same image. returns the number of differing values
+static unsigned long checkDecoders()
+{
+	const uint16_t patterns[] = {0x0000, 0xFFFF, 0x8000, 0x7FFF, 0x00FF, 0xFF00};
+	uint32_t random = 0x2545F491;
+	unsigned long values = 0;
+	unsigned long mismatches = 0;
+
+	native_spi_read = decodeImageRead;
+
+	for(unsigned long image = 0; image < NATIVE_DECODE_IMAGES; image++)
+	{
+		for(uint16_t address = 0; address < 0x100; address++)
+		{
+			// xorshift32
+			random ^= random << 13;
+			random ^= random >> 17;
+			random ^= random << 5;
+
+			bool fixed = image < sizeof(patterns) / sizeof(patterns[0]);
+			decode_image[address] = fixed ? patterns[image] : random;
+		}
+
+		startMetricsRead(TIER_MASK_ALL, halMicros(), 0);
+
+		while(!continueMetricsRead(SAMPLE_SLICE_BUDGET_US))
+			;
+
+		for(uint8_t index_metric = 0; index_metric < metricCount(); index_metric++)
+		{
+			const struct Metric &metric = metricAt(index_metric);
+
+			for(uint8_t index_phase = 0; index_phase < strlen(metric.phases); index_phase++)
+			{
+				uint16_t address = metric.address + index_phase;
+				uint16_t lsb = hasLSB(metric.type) ? decode_image[address + REGISTER_LSB_OFFSET] : 0;
+				int32_t expected = legacyDecode(metric, decode_image[address], lsb);
+				int32_t decoded = latestRaw(index_metric, index_phase);
+
+				values++;
+
+				if(decoded == expected)
+					continue;
+
+				if(!mismatches)
+					printf("decode: %s %c (register 0x%02X) is %d, expected %d\n", metric.name, metric.phases[index_phase], metric.address + index_phase, decoded, expected);
+
+				mismatches++;
+			}
+		}
+	}
+
+	native_spi_read = simRead;
+
+	printf("decode: %lu images, %lu values, %lu mismatches\n", (unsigned long)NATIVE_DECODE_IMAGES, values, mismatches);
+
+	return mismatches;
+}
+
+// per-register decode of every value of the metrics for every scenario of checkReadPlan()
+#define NATIVE_READPLAN_SCENARIOS 4
+#define NATIVE_READPLAN_VALUES 64
+static int32_t readplan_expected[NATIVE_READPLAN_SCENARIOS][NATIVE_READPLAN_VALUES];
+
+// one sample of every tier on its own for every scenario of the simulator, read through the read plan bursts and
+// decode steps, must equal reading each value's MSB and LSB register one by one. then the tiers are sampled with
+// the shortest possible slices and a new scenario (measurement) after every slice, every value must be the one of
+// a single scenario: the slices must not end between the MSB and LSB of a value. returns the number of differing values
+static unsigned long checkReadPlan()
+{
+	const char *scenarios[NATIVE_READPLAN_SCENARIOS] = {"balanced", "unbalanced", "export", "idle"};
+	unsigned long values = 0;
+	unsigned long mismatches = 0;
+
+	uint8_t value_count = 0;
+	for(uint8_t index_metric = 0; index_metric < metricCount(); index_metric++)
+		value_count += strlen(metricAt(index_metric).phases);
+
+	if(value_count > NATIVE_READPLAN_VALUES)
+	{
+		printf("readplan: %u values, NATIVE_READPLAN_VALUES is too small\n", value_count);
+		return 1;
+	}
+
+	for(uint8_t index_scenario = 0; index_scenario < NATIVE_READPLAN_SCENARIOS; index_scenario++)
+	{
+		simLoadScenario(scenarios[index_scenario]);
+
+		for(uint8_t tier = 0; tier < TIER_COUNT; tier++)
+		{
+			startMetricsRead(1 << tier, halMicros(), 0);
+
+			while(!continueMetricsRead(SAMPLE_SLICE_BUDGET_US))
+				;
+
+			uint8_t index_value = 0;
+
+			for(uint8_t index_metric = 0; index_metric < metricCount(); index_metric++)
+			{
+				const struct Metric &metric = metricAt(index_metric);
+
+				for(uint8_t index_phase = 0; index_phase < strlen(metric.phases); index_phase++, index_value++)
+				{
+					if(metric.tier != tier)
+						continue;
+
+					uint16_t address = metric.address + index_phase;
+					uint16_t msb = readATM90E36(address);
+					uint16_t lsb = hasLSB(metric.type) ? readATM90E36(address + REGISTER_LSB_OFFSET) : msb;
+
+					int32_t expected = legacyDecode(metric, msb, lsb);
+					int32_t decoded = latestRaw(index_metric, index_phase);
+
+					readplan_expected[index_scenario][index_value] = expected;
+					values++;
+
+					if(decoded == expected)
+						continue;
+
+					if(!mismatches)
+						printf("readplan: %s %s %c (register 0x%02X) is %d, expected %d\n", scenarios[index_scenario], metric.name,
+							metric.phases[index_phase], address, decoded, expected);
+
+					mismatches++;
+				}
+			}
+		}
+	}
+
+	uint8_t index_scenario = 0;
+
+	for(uint8_t tier = 0; tier < TIER_COUNT; tier++)
+	{
+		startMetricsRead(1 << tier, halMicros(), 0);
+
+		while(!continueMetricsRead(0))
+			simLoadScenario(scenarios[++index_scenario % NATIVE_READPLAN_SCENARIOS]);
+
+		uint8_t index_value = 0;
+
+		for(uint8_t index_metric = 0; index_metric < metricCount(); index_metric++)
+		{
+			const struct Metric &metric = metricAt(index_metric);
+
+			for(uint8_t index_phase = 0; index_phase < strlen(metric.phases); index_phase++, index_value++)
+			{
+				if(metric.tier != tier)
+					continue;
+
+				int32_t decoded = latestRaw(index_metric, index_phase);
+				bool found = false;
+
+				for(uint8_t i = 0; i < NATIVE_READPLAN_SCENARIOS; i++)
+					found |= decoded == readplan_expected[i][index_value];
+
+				values++;
+
+				if(found)
+					continue;
+
+				if(!mismatches)
+					printf("readplan: %s %c (register 0x%02X) is %d, torn between slices\n", metric.name, metric.phases[index_phase],
+						metric.address + index_phase, decoded);
+
+				mismatches++;
+			}
+		}
+	}
+
+	printf("readplan: %lu values, %lu mismatches\n", values, mismatches);
+
+	return mismatches;
+}
+
+// loop() iterations for ms of emulated time, sampling only
+static void runSampling(unsigned long ms)
+{
+	for(unsigned long step = 0; step < ms / NATIVE_LOOP_STEP_MS; step++)
+	{
+		nativeAdvanceTime(NATIVE_LOOP_STEP_MS * 1000UL);
+		handleSampling();
+		handleMetricsCommit();
+	}
+}
+
+// reads the rest of the current sample without advancing the emulated clock
+static void finishSample()
+{
+	while(metricsReadBusy())
+		handleSampling();
+
+	handleMetricsCommit();
+}
+
+// running weighted sum of every value against the sum over its ring buffer, returns the number of differing values
+static unsigned long compareSampleSums(const char *when)
+{
+	unsigned long mismatches = 0;
+
+	for(uint8_t index_metric = 0; index_metric < metricCount(); index_metric++)
+	{
+		const struct Metric &metric = metricAt(index_metric);
+
+		for(uint8_t index_phase = 0; index_phase < strlen(metric.phases); index_phase++)
+		{
+			int64_t expected = 0;
+
+			for(uint8_t index = 0; index < tierFilled(metric.tier); index++)
+				expected += (int64_t)sampleRaw(index_metric, index_phase, index) * storedWeight(metric.tier, index);
+
+			if(sampleSum(index_metric, index_phase) == expected)
+				continue;
+
+			if(!mismatches)
+				printf("stall: %s sum of %s %c is %lld, expected %lld\n", when, metric.name, metric.phases[index_phase],
+					(long long)sampleSum(index_metric, index_phase), (long long)expected);
+
+			mismatches++;
+		}
+	}
+
+	return mismatches;
+}
+
+// loop() blocked for NATIVE_STALL_MS right after a normal tier tick (the fast tier ticks on the same grid): the ticks
+// in between must be counted as missed, the next sample of the tier must be weighted with the intervals it covers
+// (at most SAMPLE_WEIGHT_MAX) and the running sums must equal the weighted sums over the ring buffers, right after
+// the stall and once its samples have left the windows. returns the number of failed checks
+static unsigned long checkStall()
+{
+	unsigned long failed = 0;
+
+	postSetting("buff", NATIVE_STALL_SAMPLE_COUNT);
+
+	// fill the windows, evicting samples of weight 1
+	runSampling(2 * NATIVE_STALL_SAMPLE_COUNT * SAMPLE_INTERVAL_MS);
+
+	uint32_t count = histogram_tick.count;
+
+	while(histogram_tick.count == count)
+		runSampling(NATIVE_LOOP_STEP_MS);
+
+	finishSample();
+
+	uint32_t missed[TIER_COUNT];
+
+	for(uint8_t tier = 0; tier < TIER_COUNT; tier++)
+		missed[tier] = sample_ticks_missed[tier];
+
+	// different values for the samples after the stall
+	simLoadScenario("unbalanced");
+
+	nativeAdvanceTime(NATIVE_STALL_MS * 1000UL);
+	handleSampling();
+	finishSample();
+
+	const uint8_t stalled_tiers[] = {TIER_FAST, TIER_NORMAL};
+
+	for(uint8_t i = 0; i < sizeof(stalled_tiers); i++)
+	{
+		uint8_t tier = stalled_tiers[i];
+		unsigned long interval = sample_tiers[tier].interval_ms;
+
+		uint32_t expected_missed = NATIVE_STALL_MS / interval - 1;
+		uint8_t expected_weight = min((NATIVE_STALL_MS + interval / 2) / interval, (unsigned long)SAMPLE_WEIGHT_MAX);
+
+		uint32_t counted = sample_ticks_missed[tier] - missed[tier];
+		uint8_t weight = storedWeight(tier, latestIndex(tier));
+
+		if(counted != expected_missed)
+		{
+			printf("stall: %u missed %s ticks, expected %u\n", counted, sample_tiers[tier].name, expected_missed);
+			failed++;
+		}
+
+		if(weight != expected_weight)
+		{
+			printf("stall: %s sample weight %u, expected %u\n", sample_tiers[tier].name, weight, expected_weight);
+			failed++;
+		}
+	}
+
+	failed += compareSampleSums("after the stall");
+
+	runSampling(2 * NATIVE_STALL_SAMPLE_COUNT * SAMPLE_INTERVAL_MS);
+
+	failed += compareSampleSums("after eviction");
+
+	printf("stall: %lu failed\n", failed);
+
+	return failed;
+}
+
+// DFT result of checkHarmonics() for a channel in the order of the registers (current A - C, voltage A - C) and a
+// register of the channel (ratio of order index + 2, index HARMONIC_ORDERS: THD), including the extreme values
+static uint16_t harmonicsImageValue(uint8_t channel, uint8_t index)
+{
+	if(index == HARMONIC_ORDERS)
+		return 1000 + 111 * channel;
+
+	if(index == 0)
+		return 0;
+	if(index == 1)
+		return 0xFFFF;
+
+	return 1000 * channel + 37 * index;
+}
+
+// the analysis is always complete, the rest of the registers come from the simulator
+static uint16_t harmonicsImageRead(uint16_t address)
+{
+	if(address == DFT_CTRL)
+		return 0;
+
+	if((address >= AI_HR2) && (address < AI_FUND))
+		return harmonicsImageValue((address - AI_HR2) / 0x20, (address - AI_HR2) % 0x20);
+
+	return simRead(address);
+}
+
+// one analysis of known DFT results read by handleHarmonics(), every ratio and THD must be rendered with its value
+// in percent. returns the number of missing or differing lines
+static unsigned long checkHarmonics()
+{
+	native_spi_read = harmonicsImageRead;
+
+	initHarmonics();
+
+	for(uint8_t call = 0; (call < 2 + HARMONICS_CHANNELS) && !harmonics_valid; call++)
+		handleHarmonics();
+
+	native_spi_read = simRead;
+
+	// the harmonic lines of /allmetrics, without waiting for the sample buffers
+	responseBegin(200, "text/plain");
+	for(uint16_t line = 0; writeHarmonicsLine(line); line++)
+		;
+	responseEnd();
+
+	const std::string &content = native_http_response.content;
+	unsigned long lines = 0;
+	unsigned long mismatches = 0;
+
+	for(uint8_t voltage = 0; voltage < 2; voltage++)
+	{
+		for(uint8_t phase = 0; phase < 3; phase++)
+		{
+			for(uint8_t index = 0; index <= HARMONIC_ORDERS; index++)
+			{
+				uint16_t value = harmonicsImageValue(voltage ? 3 + phase : phase, index);
+				char line[160];
+
+				if(index < HARMONIC_ORDERS)
+					snprintf(line, sizeof(line), "%s,loc=%s,name=harmonic_%s,phase=%c,order=%u value=%u.%02u\n", setting_metric_name,
+						setting_location_tag, voltage ? "voltage" : "current", "ABC"[phase], index + 2, value / 100, value % 100);
+				else
+					snprintf(line, sizeof(line), "%s,loc=%s,name=thd_%s,phase=%c value=%u.%02u\n", setting_metric_name,
+						setting_location_tag, voltage ? "voltage" : "current", "ABC"[phase], value / 100, value % 100);
+
+				lines++;
+
+				if(content.find(line) != std::string::npos)
+					continue;
+
+				if(!mismatches)
+					printf("harmonics: missing %s", line);
+
+				mismatches++;
+			}
+		}
+	}
+
+	printf("harmonics: %lu lines, %lu mismatches\n", lines, mismatches);
+
+	return mismatches;
+}
+
+// compare formatFixed() with the String(double) conversion it replaced, for a voltage-like value with 2 decimals
+static void benchmarkFormatting()
+{
+	char number_buffer[FORMAT_BUFFER_LENGTH];
+	unsigned long length = 0;
+
+	unsigned long start = halMicros();
+	for(long i = 0; i < NATIVE_FORMAT_COUNT; i++)
+		length += formatFixed(number_buffer, 23000 + i, 100, 2);
+	unsigned long fixed_time = halMicros() - start;
+
+	start = halMicros();
+	for(long i = 0; i < NATIVE_FORMAT_COUNT; i++)
+		length += String((23000 + i) * 0.01, 2).length();
+	unsigned long string_time = halMicros() - start;
+
+	printf("formatFixed: %.3f us/value, String(double): %.3f us/value (%lu chars)\n",
+		(double)fixed_time / NATIVE_FORMAT_COUNT, (double)string_time / NATIVE_FORMAT_COUNT, length);
+}
+
+// check that a blank FRAM block means timer sampling and that the zero crossing pin survives a reload
+static int checkSettings()
+{
+	int failed = 0;
+
+	if(setting_zx_pin != -1)
+	{
+		printf("zxp %lld from blank FRAM\n", (long long)setting_zx_pin);
+		failed++;
+	}
+
+	const long pins[] = {0, 5, -1};
+
+	for(uint8_t i = 0; i < 3; i++)
+	{
+		postSetting("zxp", pins[i]);
+		initSettings();
+
+		if(setting_zx_pin != pins[i])
+		{
+			printf("zxp %lld after storing %ld\n", (long long)setting_zx_pin, pins[i]);
+			failed++;
+		}
+	}
+
+	printf("settings: %d failed\n", failed);
+	return failed;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long ticks = 1000;
+	const char *scenario = "balanced";
+	const char *influx_port = NULL;
+	const char *mqtt_port = NULL;
+	long mqtt_format = MQTT_FORMAT_PACKED;
+	long mqtt_qos = 0;
+	const char *check = (argc > 1) ? argv[1] : "";
+
+	if(argc > 1)
+		ticks = strtoul(argv[1], NULL, 10);
+	if(argc > 2)
+		scenario = argv[2];
+	if((argc > 3) && strcmp(argv[3], "0"))
+		influx_port = argv[3];
+	if((argc > 4) && strcmp(argv[4], "0"))
+		mqtt_port = argv[4];
+	if(argc > 5)
+		mqtt_format = strtol(argv[5], NULL, 10);
+	if(argc > 6)
+		mqtt_qos = strtol(argv[6], NULL, 10);
+
+	simInit();
+
+	if(!simLoadScenario(scenario))
+	{
+		printf("unknown scenario %s\n", scenario);
+		return 1;
+	}
+
+	initFRAM();
+	initSettings();
+	initMetrics();
+	initHistory();
+	initInflux();
+	configureMqtt();
+	initATM90E36();
+	initSampling();
+	initHarmonics();
+
+	if(!strcmp(check, "decode"))
+		return checkDecoders() ? 1 : 0;
+	if(!strcmp(check, "harmonics"))
+		return checkHarmonics() ? 1 : 0;
+	if(!strcmp(check, "settings"))
+		return checkSettings() ? 1 : 0;
+
+	// calibrate the gains to the simulated chip
+	const char *voltage_gain_ids[] = {"ugnA", "ugnB", "ugnC"};
+	const char *current_gain_ids[] = {"ignA", "ignB", "ignC"};
+
+	for(uint8_t phase = 0; phase < 3; phase++)
+	{
+		postSetting(voltage_gain_ids[phase], sim_ideal_voltage_gain[phase]);
+		postSetting(current_gain_ids[phase], sim_ideal_current_gain[phase]);
+	}
+
+	// with calibrated gains, so the measurements are not zero
+	if(!strcmp(check, "readplan"))
+		return checkReadPlan() ? 1 : 0;
+	if(!strcmp(check, "stall"))
+		return checkStall() ? 1 : 0;
+
+	if(influx_port)
+	{
+		native_epoch_sync_ms = halMillis() + NATIVE_EPOCH_SYNC_MS;
+
+		postSetting("iint", 10);
+		postSetting("iprt", influx_port);
+		postSetting("ihst", "127.0.0.1");
+	}
+
+	if(mqtt_port)
+	{
+		postSetting("mfmt", mqtt_format);
+		postSetting("mqos", mqtt_qos);
+		postSetting("mprt", mqtt_port);
+		postSetting("mhst", "127.0.0.1");
+	}
+
+	int64_t energy_start[4];
+	for(uint8_t i = 0; i < 4; i++)
+		energy_start[i] = setting_energy_total[i];
+
+	double sim_energy_start[4];
+	for(uint8_t i = 0; i < 4; i++)
+		sim_energy_start[i] = simEnergyForward(i) - simEnergyReverse(i);
+
+	unsigned long read_time = 0;
+	unsigned long handler_time = 0;
+	unsigned long spi_reads = sim_read_count;
+
+	for(unsigned long tick = 0; tick < ticks; tick++)
+	{
+		// one tick of the normal tier, the other tiers are scheduled by handleSampling()
+		for(unsigned long step = 0; step < SAMPLE_INTERVAL_MS / NATIVE_LOOP_STEP_MS; step++)
+		{
+			nativeAdvanceTime(NATIVE_LOOP_STEP_MS * 1000UL);
+
+			unsigned long start = halMicros();
+			handleSampling();
+			handleHarmonics();
+			read_time += halMicros() - start;
+
+			handleMetricsCommit();
+
+			handleInflux();
+			handleMqtt();
+			handleMetricsMqtt();
+		}
+
+		unsigned long middle = halMicros();
+
+		for(uint8_t scraper = 0; scraper < NATIVE_SCRAPERS; scraper++)
+		{
+			handleMetrics();
+			handleAllMetrics();
+			handleMetricsNew();
+		}
+
+		handler_time += halMicros() - middle;
+	}
+
+	spi_reads = sim_read_count - spi_reads;
+
+	handleAllMetrics();
+	printf("%s\n", native_http_response.content.c_str());
+
+	printf("scenario: %s\n", scenario);
+	for(uint8_t phase = 0; phase < 3; phase++)
+	{
+		const struct SimPhase &p = simGetScenario().phases[phase];
+		printf("  phase %c: %.2f V, %.3f A, %.1f deg\n", 'A' + phase, p.voltage, p.current, p.current_angle);
+	}
+
+	const char *phases = "TABC";
+	for(uint8_t i = 0; i < 4; i++)
+	{
+		printf("energy %c: meter %.4f kWh, simulated %.4f kWh\n", phases[i],
+			(setting_energy_total[i] - energy_start[i]) / 10000.,
+			(simEnergyForward(i) - simEnergyReverse(i) - sim_energy_start[i]) / 10000.);
+	}
+
+	printf("ticks: %lu\n", ticks);
+	printf("sampling:    %.3f us/tick (including emulated SPI delays)\n", (double)read_time / ticks);
+	printf("handlers:    %.3f us/tick\n", (double)handler_time / ticks);
+	printf("register reads: %.1f per tick\n", (double)spi_reads / ticks);
+	printf("udp packets: %lu (%lu bytes)\n", native_udp_packets, native_udp_bytes);
+	printf("influx: %u records sent, %u dropped, %u queued, %u failed posts (%lu posts)\n",
+		influx_records_sent, influx_records_dropped, influxQueued(), influx_posts_failed, native_http_posts);
+	printf("mqtt: %u connects, %u published, %u dropped, %u lost\n",
+		mqtt_connects, mqtt_messages_published, mqtt_messages_dropped, mqtt_messages_lost);
+	printf("sample interval: %u samples, %.1f ms mean, %.1f ms max\n", histogram_tick.count,
+		histogram_tick.count ? histogram_tick.sum / 1000. / histogram_tick.count : 0., histogram_tick.max / 1000.);
+	printf("missed ticks: %u fast, %u normal, %u slow, %u minute\n",
+		sample_ticks_missed[TIER_FAST], sample_ticks_missed[TIER_NORMAL], sample_ticks_missed[TIER_SLOW], sample_ticks_missed[TIER_MINUTE]);
+	printf("response cache: %u hits, %u misses, %u overflows\n", response_cache_hits, response_cache_misses, response_cache_overflows);
+
+	benchmarkFormatting();
+
+	return 0;
+}
@@ -0,0 +1,53 @@
+#ifndef NATIVE_h
+#define NATIVE_h
+
+#include <map>
+#include <string>
+
+#include "Arduino.h"
+
+// controls for the fake back-ends of the native build (see hal_native.cpp)
+
+// ATM90E36 register access used by the fake SPI bus, defaults to a plain register file
+extern uint16_t (*native_spi_read)(uint16_t address);
+extern void (*native_spi_write)(uint16_t address, uint16_t value);
+extern uint16_t native_registers[0x400];
+
+// size of the emulated FRAM (MB85RC64)
+#define NATIVE_FRAM_SIZE 0x2000
+extern uint8_t native_fram[NATIVE_FRAM_SIZE];
+
+// the clock follows the host clock, delays do not sleep but advance the clock instead
+void nativeAdvanceTime(unsigned long us);
+
+// emulate a rising edge on the zero crossing input (ignored unless halZeroCrossingBegin enabled it)
+void nativeZeroCrossing();
+
+// arguments of the next request and the last response sent by a handler
+struct NativeHttpResponse
+{
+	int code;
+	std::string content_type;
+	std::string content;
+	std::map<std::string, std::string> headers;
+};
+
+extern std::map<std::string, std::string> native_http_args;
+extern NativeHttpResponse native_http_response;
+// handlers registered with halHttpOn(), key "GET /path" or "POST /path"
+extern std::map<std::string, void (*)()> native_http_routes;
+extern bool native_restart_requested;
+// bodies sent with halHttpSendFill() are pulled in pieces of this size (one TCP segment)
+#define NATIVE_HTTP_FILL_LENGTH 1460
+
+extern unsigned long native_udp_packets;
+extern unsigned long native_udp_bytes;
+// content of the last datagram
+extern std::string native_udp_last;
+
+// number of halHttpPostBegin() calls, the requests go to a real socket (e.g. influx_standin.py)
+extern unsigned long native_http_posts;
+// halEpochSeconds() returns 0 (clock not synchronized) until halMillis() reaches this time
+extern unsigned long native_epoch_sync_ms;
+
+#endif
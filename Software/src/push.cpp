@@ -0,0 +1,116 @@
+#include "Arduino.h"
+#include "hal.h"
+#include "push.h"
+#include "settings.h"
+
+uint8_t push_datagram[PUSH_DATAGRAM_LENGTH];
+uint16_t push_length = 0;
+uint8_t push_samples = 0;
+unsigned long push_first_time_us = 0;
+uint32_t push_sequence = 0;
+
+uint8_t push_address[4];
+bool push_address_valid = false;
+
+uint32_t push_packets_sent = 0;
+uint32_t push_packets_dropped = 0;
+
+// dotted decimal IPv4 address
+bool parseAddress(uint8_t address[4], const char *text)
+{
+	for(uint8_t i = 0; i < 4; i++)
+	{
+		uint16_t value = 0;
+		uint8_t digits = 0;
+
+		while((*text >= '0') && (*text <= '9') && (digits < 3))
+		{
+			value = value * 10 + (*(text++) - '0');
+			digits++;
+		}
+
+		if((!digits) || (value > 255))
+			return false;
+
+		address[i] = value;
+
+		if(*text != ((i < 3) ? '.' : 0))
+			return false;
+
+		text++;
+	}
+
+	return true;
+}
+
+void configurePush()
+{
+	pushFlush();
+
+	push_address_valid = parseAddress(push_address, setting_push_target);
+
+	if(!(push_address[0] | push_address[1] | push_address[2] | push_address[3]))
+		push_address_valid = false;
+}
+
+bool pushEnabled()
+{
+	return push_address_valid;
+}
+
+uint8_t pushSamples()
+{
+	return push_samples;
+}
+
+uint32_t pushSequence()
+{
+	return push_sequence;
+}
+
+uint16_t pushOffsetMs(unsigned long time_us)
+{
+	if(!push_samples)
+		return 0;
+
+	return (time_us - push_first_time_us) / 1000;
+}
+
+bool pushAppend(const uint8_t *data, uint16_t length, unsigned long time_us)
+{
+	if(push_length + length > PUSH_DATAGRAM_LENGTH)
+	{
+		if(!push_samples)
+			push_packets_dropped++;
+
+		return false;
+	}
+
+	if(!push_samples)
+		push_first_time_us = time_us;
+
+	memcpy(push_datagram + push_length, data, length);
+	push_length += length;
+	push_samples++;
+
+	if(push_samples >= setting_push_interval)
+		pushFlush();
+
+	return true;
+}
+
+void pushFlush()
+{
+	if(!push_samples)
+		return;
+
+	if(halUdpSend(push_address, setting_push_port, (const char*)push_datagram, push_length))
+		push_packets_sent++;
+	else
+		push_packets_dropped++;
+
+	// a dropped datagram keeps its sequence number as well, the receiver sees the gap
+	push_sequence++;
+	push_length = 0;
+	push_samples = 0;
+}
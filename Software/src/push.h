@@ -0,0 +1,35 @@
+#ifndef PUSH_h
+#define PUSH_h
+
+#include <stdint.h>
+
+// batched UDP push: the samples of setting_push_interval sample ticks are collected in one datagram and sent to
+// setting_push_target:setting_push_port. every datagram carries a sequence number (consecutive, starts at 0 after boot)
+// so the receiver can detect lost datagrams, and every sample its time offset to the first sample of the datagram.
+// the encoding of the samples (text or binary, setting_push_format) is done by metrics.cpp
+
+// parses the push settings, a pending datagram is sent to the old target first
+void configurePush();
+// false if the target is 0.0.0.0 or not a valid address
+bool pushEnabled();
+// number of samples in the pending datagram (0: the next sample starts a new one) and its sequence number
+uint8_t pushSamples();
+uint32_t pushSequence();
+// time of a sample relative to the first sample of the pending datagram
+uint16_t pushOffsetMs(unsigned long time_us);
+// adds an encoded sample to the pending datagram, returns false if it does not fit. the datagram is sent
+// when it holds setting_push_interval samples
+bool pushAppend(const uint8_t *data, uint16_t length, unsigned long time_us);
+// sends the pending datagram
+void pushFlush();
+
+// largest UDP payload that fits into one ethernet frame
+#define PUSH_DATAGRAM_LENGTH 1472
+// samples per datagram
+#define PUSH_INTERVAL_MAX 20
+
+extern uint32_t push_packets_sent;
+// datagrams that could not be sent and samples that did not even fit into an empty datagram
+extern uint32_t push_packets_dropped;
+
+#endif
@@ -0,0 +1,383 @@
+#ifndef READPLAN_h
+#define READPLAN_h
+
+#include <stdint.h>
+
+enum ValueType {LSB_UNSIGNED = 1, LSB_COMPLEMENT = 2, NOLSB_UNSIGNED = 3, NOLSB_SIGNED = 4};
+#define VALUE_TYPE_COUNT 5
+
+struct Metric
+{
+	// content of the name tag
+	const char *name;
+	// content for the phase tag, every char makes a new value.
+	// ABC=individual phases, N=neutral (for calculated current and metrics that don't belong to a particular phase),
+	// T=total
+	const char *phases;
+	// address of SPI register
+	unsigned short address;
+	// factor to convert the raw integer value to its unit: value = raw * factor_numerator / factor_denominator
+	// when LSB is used, a factor of 1/256 is added automatically
+	int16_t factor_numerator;
+	uint16_t factor_denominator;
+	// wether to use the additional LSB register
+	enum ValueType type;
+	// number of decimal places to show
+	uint8_t decimals;
+	// showInMain = false -> the metric is only shown on /allmetrics
+	bool showInMain;
+	// sampling tier (interval and buffer depth, see sample_tiers[])
+	uint8_t tier;
+};
+
+struct RegisterBlock
+{
+	// first register of the block
+	uint16_t address;
+	// number of consecutive registers
+	uint8_t count;
+	// a read slice may end after this block: no MSB / LSB pair is read partly before and partly after it,
+	// so a new measurement in between cannot tear a value
+	bool split;
+};
+
+struct DecodeStep
+{
+	// index of the MSB and LSB register in the register cache (lsb == msb for NOLSB types)
+	uint8_t msb;
+	uint8_t lsb;
+	// index of the value in the sample buffers
+	uint8_t slot;
+};
+
+// the register cache holds registers 0x80 - 0xFF, all metrics must be in this range
+#define REGISTER_CACHE_START 0x80
+#define REGISTER_CACHE_SIZE (0x100 - REGISTER_CACHE_START)
+
+// LSB registers are located 0x10 above their MSB register
+#define REGISTER_LSB_OFFSET 0x10
+
+// registers from PmeanT upwards have no side effects when read, so small gaps between
+// them are read along with the block instead of starting a new burst (every burst costs one address word)
+#define READ_PLAN_GAP_START 0xB0
+#define READ_PLAN_GAP_MAX 1
+
+#define READ_PLAN_BLOCKS_MAX 16
+
+template<uint8_t value_count>
+struct ReadPlan
+{
+	// false if a register is outside of the register cache or there are too many blocks
+	bool valid;
+
+	struct RegisterBlock blocks[READ_PLAN_BLOCKS_MAX];
+	uint8_t block_count;
+
+	// additional range of registers of makeReadPlan()
+	uint16_t extra_address;
+	uint8_t extra_count;
+
+	// decode steps, sorted by value type: steps[type_start[t]] to steps[type_start[t + 1] - 1] have type t
+	struct DecodeStep steps[value_count];
+	uint8_t type_start[VALUE_TYPE_COUNT + 1];
+};
+
+template<uint8_t metric_count, uint8_t value_count>
+struct MetricLayout
+{
+	// first sample buffer slot and number of phases of every metric
+	uint8_t first_slot[metric_count];
+	uint8_t phase_count[metric_count];
+	// position of the ring buffer of every slot in the sample arena and total arena length (values)
+	uint16_t slot_offset[value_count];
+	uint16_t arena_length;
+};
+
+constexpr uint8_t countPhases(const char *phases)
+{
+	uint8_t count = 0;
+
+	while(phases[count])
+		count++;
+
+	return count;
+}
+
+constexpr bool hasLSB(enum ValueType type)
+{
+	return (type == LSB_UNSIGNED) || (type == LSB_COMPLEMENT);
+}
+
+template<uint8_t metric_count>
+constexpr uint8_t countValues(const struct Metric (&table)[metric_count])
+{
+	uint8_t count = 0;
+
+	for(uint8_t index_metric = 0; index_metric < metric_count; index_metric++)
+		count += countPhases(table[index_metric].phases);
+
+	return count;
+}
+
+// number of values shown on the main page
+template<uint8_t metric_count>
+constexpr uint8_t countMainValues(const struct Metric (&table)[metric_count])
+{
+	uint8_t count = 0;
+
+	for(uint8_t index_metric = 0; index_metric < metric_count; index_metric++)
+		if(table[index_metric].showInMain)
+			count += countPhases(table[index_metric].phases);
+
+	return count;
+}
+
+// index of the metric that starts at a register address
+template<uint8_t metric_count>
+constexpr uint8_t findMetric(const struct Metric (&table)[metric_count], unsigned short address)
+{
+	for(uint8_t index_metric = 0; index_metric < metric_count; index_metric++)
+		if(table[index_metric].address == address)
+			return index_metric;
+
+	return metric_count;
+}
+
+constexpr uint32_t hashByte(uint32_t hash, uint8_t byte)
+{
+	return (hash ^ byte) * 16777619u;
+}
+
+// FNV-1a hash of everything needed to decode the raw values of a metric table, in the order of /metrics.schema:
+// for every metric its name and phases (each with terminating zero), factor numerator and denominator
+// (16 bit little endian), LSB shift (8 or 0) and decimals
+template<uint8_t metric_count>
+constexpr uint32_t makeSchemaHash(const struct Metric (&table)[metric_count])
+{
+	uint32_t hash = 2166136261u;
+
+	for(uint8_t index_metric = 0; index_metric < metric_count; index_metric++)
+	{
+		const struct Metric &metric = table[index_metric];
+
+		for(uint8_t i = 0; metric.name[i]; i++)
+			hash = hashByte(hash, metric.name[i]);
+		hash = hashByte(hash, 0);
+
+		for(uint8_t i = 0; metric.phases[i]; i++)
+			hash = hashByte(hash, metric.phases[i]);
+		hash = hashByte(hash, 0);
+
+		hash = hashByte(hash, (uint16_t)metric.factor_numerator & 0xFF);
+		hash = hashByte(hash, (uint16_t)metric.factor_numerator >> 8);
+		hash = hashByte(hash, metric.factor_denominator & 0xFF);
+		hash = hashByte(hash, metric.factor_denominator >> 8);
+		hash = hashByte(hash, hasLSB(metric.type) ? 8 : 0);
+		hash = hashByte(hash, metric.decimals);
+	}
+
+	return hash;
+}
+
+// lays out the ring buffers of all metrics and phases back to back, every buffer holds the depth of the metric's tier
+template<uint8_t value_count, uint8_t metric_count, typename Tier, uint8_t tier_count>
+constexpr MetricLayout<metric_count, value_count> makeMetricLayout(const struct Metric (&table)[metric_count], const Tier (&tiers)[tier_count])
+{
+	MetricLayout<metric_count, value_count> layout{};
+	uint8_t slot = 0;
+	uint16_t offset = 0;
+
+	for(uint8_t index_metric = 0; index_metric < metric_count; index_metric++)
+	{
+		layout.first_slot[index_metric] = slot;
+		layout.phase_count[index_metric] = countPhases(table[index_metric].phases);
+
+		for(uint8_t index_phase = 0; index_phase < layout.phase_count[index_metric]; index_phase++, slot++)
+		{
+			layout.slot_offset[slot] = offset;
+			offset += tiers[table[index_metric].tier].depth;
+		}
+	}
+
+	layout.arena_length = offset;
+
+	return layout;
+}
+
+// builds the sorted, deduplicated list of register bursts and the decode steps for the metrics of one tier.
+// extra_address / extra_count describe an additional range of registers that must be read (energy registers)
+template<uint8_t value_count, uint8_t metric_count>
+constexpr ReadPlan<value_count> makeReadPlan(const struct Metric (&table)[metric_count], uint8_t tier, uint16_t extra_address, uint8_t extra_count)
+{
+	ReadPlan<value_count> plan{};
+	bool required[REGISTER_CACHE_SIZE] = {};
+
+	plan.valid = true;
+	plan.extra_address = extra_address;
+	plan.extra_count = extra_count;
+
+	for(uint8_t i = 0; i < extra_count; i++)
+	{
+		if((extra_address + i < REGISTER_CACHE_START) || (extra_address + i >= 0x100))
+			plan.valid = false;
+		else
+			required[extra_address + i - REGISTER_CACHE_START] = true;
+	}
+
+	// group decode steps by value type
+	uint8_t index_step = 0;
+
+	for(uint8_t type = 0; type < VALUE_TYPE_COUNT; type++)
+	{
+		plan.type_start[type] = index_step;
+		uint8_t slot = 0;
+
+		for(uint8_t index_metric = 0; index_metric < metric_count; index_metric++)
+		{
+			const struct Metric &metric = table[index_metric];
+			uint8_t phasecount = countPhases(metric.phases);
+
+			for(uint8_t index_phase = 0; index_phase < phasecount; index_phase++, slot++)
+			{
+				if((metric.type != type) || (metric.tier != tier))
+					continue;
+
+				uint16_t msb = metric.address + index_phase;
+				uint16_t lsb = hasLSB(metric.type) ? msb + REGISTER_LSB_OFFSET : msb;
+
+				if((msb < REGISTER_CACHE_START) || (lsb >= 0x100) || (index_step >= value_count))
+				{
+					plan.valid = false;
+					continue;
+				}
+
+				required[msb - REGISTER_CACHE_START] = true;
+				required[lsb - REGISTER_CACHE_START] = true;
+
+				plan.steps[index_step].msb = msb - REGISTER_CACHE_START;
+				plan.steps[index_step].lsb = lsb - REGISTER_CACHE_START;
+				plan.steps[index_step].slot = slot;
+				index_step++;
+			}
+		}
+	}
+	plan.type_start[VALUE_TYPE_COUNT] = index_step;
+
+	// merge required registers into bursts, walking the register space in ascending order
+	uint8_t index = 0;
+
+	while(index < REGISTER_CACHE_SIZE)
+	{
+		if(!required[index])
+		{
+			index++;
+			continue;
+		}
+
+		uint8_t end = index + 1;
+
+		while(end < REGISTER_CACHE_SIZE)
+		{
+			if(required[end])
+			{
+				end++;
+				continue;
+			}
+
+			// look for the next required register within the allowed gap
+			uint8_t next = end;
+			while((next < REGISTER_CACHE_SIZE) && (!required[next]) && (next - end < READ_PLAN_GAP_MAX))
+				next++;
+
+			// only blocks that start above the registers with side effects bridge gaps
+			if((next < REGISTER_CACHE_SIZE) && required[next] && (index + REGISTER_CACHE_START >= READ_PLAN_GAP_START))
+				end = next;
+			else
+				break;
+		}
+
+		if(plan.block_count >= READ_PLAN_BLOCKS_MAX)
+		{
+			plan.valid = false;
+			break;
+		}
+
+		plan.blocks[plan.block_count].address = index + REGISTER_CACHE_START;
+		plan.blocks[plan.block_count].count = end - index;
+		plan.blocks[plan.block_count].split = true;
+
+		for(uint8_t i = 0; i < index_step; i++)
+			if((plan.steps[i].msb < end) && (plan.steps[i].lsb >= end))
+				plan.blocks[plan.block_count].split = false;
+
+		plan.block_count++;
+
+		index = end;
+	}
+
+	return plan;
+}
+
+// true if a register is decoded by a step of the plan or is part of its extra range
+template<uint8_t value_count>
+constexpr bool planRequires(const ReadPlan<value_count> &plan, uint16_t address)
+{
+	if((address >= plan.extra_address) && (address < plan.extra_address + plan.extra_count))
+		return true;
+
+	for(uint8_t index_step = 0; index_step < plan.type_start[VALUE_TYPE_COUNT]; index_step++)
+		if((plan.steps[index_step].msb + REGISTER_CACHE_START == address) || (plan.steps[index_step].lsb + REGISTER_CACHE_START == address))
+			return true;
+
+	return false;
+}
+
+// false if a block that starts below READ_PLAN_GAP_START reads a register that is not required, the energy
+// registers (0x80 - 0x87) are cleared on read and must only be read by the plan that accumulates them
+template<uint8_t value_count>
+constexpr bool planGapsSafe(const ReadPlan<value_count> &plan)
+{
+	for(uint8_t index_block = 0; index_block < plan.block_count; index_block++)
+	{
+		const struct RegisterBlock &block = plan.blocks[index_block];
+
+		if(block.address >= READ_PLAN_GAP_START)
+			continue;
+
+		for(uint8_t i = 0; i < block.count; i++)
+			if(!planRequires(plan, block.address + i))
+				return false;
+	}
+
+	return true;
+}
+
+// decoders for the individual value types, msb and lsb are the raw register contents
+template<enum ValueType type>
+inline int32_t decodeValue(uint16_t msb, uint16_t lsb);
+
+template<>
+inline int32_t decodeValue<LSB_UNSIGNED>(uint16_t msb, uint16_t lsb)
+{
+	return ((int32_t)msb << 8) + (lsb >> 8);
+}
+
+template<>
+inline int32_t decodeValue<LSB_COMPLEMENT>(uint16_t msb, uint16_t lsb)
+{
+	return (int32_t)(int16_t)msb * (1 << 8) + (lsb >> 8);
+}
+
+template<>
+inline int32_t decodeValue<NOLSB_UNSIGNED>(uint16_t msb, uint16_t)
+{
+	return msb;
+}
+
+template<>
+inline int32_t decodeValue<NOLSB_SIGNED>(uint16_t msb, uint16_t)
+{
+	return (int16_t)msb;
+}
+
+#endif
@@ -0,0 +1,228 @@
+#include "Arduino.h"
+#include "hal.h"
+#include "response.h"
+#include "format.h"
+
+char response_buffer[RESPONSE_BUFFER_LENGTH];
+uint16_t response_length = 0;
+
+// cache that records the current response, NULL if none
+struct ResponseCache *response_cache = NULL;
+
+uint32_t response_cache_hits = 0;
+uint32_t response_cache_misses = 0;
+uint32_t response_cache_overflows = 0;
+uint32_t response_part_overflows = 0;
+
+// state of a response that is sent in parts, allocated for the time it is being sent
+struct ResponseParts
+{
+	ResponseRenderer render;
+	struct ResponseCursor cursor;
+	bool finished;
+	// rendered part and the bytes of it that have been sent already
+	uint16_t length;
+	uint16_t offset;
+	char data[RESPONSE_PART_LENGTH];
+};
+
+// part that is being rendered, responseWrite() writes into it instead of the current request
+struct ResponseParts *response_part = NULL;
+
+void responseFlush()
+{
+	if(response_length)
+		halHttpSendContent(response_buffer, response_length);
+
+	response_length = 0;
+}
+
+void responseBegin(int code, const char *content_type)
+{
+	response_length = 0;
+	response_cache = NULL;
+
+	halHttpBeginContent(code, content_type, HAL_HTTP_LENGTH_UNKNOWN);
+}
+
+void responseWrite(const char *data, size_t length)
+{
+	if(response_part)
+	{
+		size_t piece = min(length, (size_t)(RESPONSE_PART_LENGTH - response_part->length));
+
+		if(piece < length)
+			response_part_overflows++;
+
+		memcpy(response_part->data + response_part->length, data, piece);
+		response_part->length += piece;
+		return;
+	}
+
+	if(response_cache)
+	{
+		if(response_cache->length + length <= response_cache->capacity)
+		{
+			memcpy(response_cache->data + response_cache->length, data, length);
+			response_cache->length += length;
+		}
+		else
+		{
+			// stays invalid, the part is rendered again for the next request
+			response_cache = NULL;
+			response_cache_overflows++;
+		}
+	}
+
+	// large pieces are sent without copying them into the buffer
+	if((!response_length) && (length >= RESPONSE_BUFFER_LENGTH))
+	{
+		halHttpSendContent(data, length);
+		return;
+	}
+
+	while(length)
+	{
+		if(response_length == RESPONSE_BUFFER_LENGTH)
+			responseFlush();
+
+		size_t piece = min(length, (size_t)(RESPONSE_BUFFER_LENGTH - response_length));
+
+		memcpy(response_buffer + response_length, data, piece);
+		response_length += piece;
+		data += piece;
+		length -= piece;
+	}
+}
+
+void responseWrite(const char *text)
+{
+	responseWrite(text, strlen(text));
+}
+
+void responseWrite(const String &text)
+{
+	responseWrite(text.c_str(), text.length());
+}
+
+void responseWrite(char c)
+{
+	responseWrite(&c, 1);
+}
+
+void responseWriteInteger(int64_t value)
+{
+	char number_buffer[FORMAT_BUFFER_LENGTH];
+
+	responseWrite(number_buffer, formatInteger(number_buffer, value));
+}
+
+void responseWriteFixed(int64_t numerator, int64_t denominator, uint8_t decimals)
+{
+	char number_buffer[FORMAT_BUFFER_LENGTH];
+
+	responseWrite(number_buffer, formatFixed(number_buffer, numerator, denominator, decimals));
+}
+
+void responseWriteHex(uint32_t value)
+{
+	char number_buffer[FORMAT_BUFFER_LENGTH];
+
+	responseWrite(number_buffer, formatHex(number_buffer, value));
+}
+
+void responseEnd()
+{
+	responseFlush();
+	halHttpEndContent();
+}
+
+// copies the rendered parts into buffer, renders the next part whenever the previous one has been sent completely
+size_t responseFillParts(void *context, char *buffer, size_t length)
+{
+	struct ResponseParts &parts = *(struct ResponseParts*)context;
+	size_t filled = 0;
+
+	while(filled < length)
+	{
+		if(parts.offset < parts.length)
+		{
+			size_t piece = min(length - filled, (size_t)(parts.length - parts.offset));
+
+			memcpy(buffer + filled, parts.data + parts.offset, piece);
+			parts.offset += piece;
+			filled += piece;
+			continue;
+		}
+
+		if(parts.finished)
+			break;
+
+		parts.length = 0;
+		parts.offset = 0;
+
+		response_part = &parts;
+		parts.finished = !parts.render(parts.cursor);
+		response_part = NULL;
+
+		parts.cursor.part++;
+	}
+
+	return filled;
+}
+
+void responseFreeParts(void *context)
+{
+	delete (struct ResponseParts*)context;
+}
+
+void responseSendParts(int code, const char *content_type, ResponseRenderer render, const struct ResponseCursor &cursor)
+{
+	struct ResponseParts *parts = new struct ResponseParts;
+
+	if(!parts)
+	{
+		halHttpSend(503, "text/plain", "out of memory");
+		return;
+	}
+
+	parts->render = render;
+	parts->cursor = cursor;
+	parts->cursor.part = 0;
+	parts->finished = false;
+	parts->length = 0;
+	parts->offset = 0;
+
+	halHttpSendFill(code, content_type, responseFillParts, parts, responseFreeParts);
+}
+
+bool responseWriteCached(struct ResponseCache &cache)
+{
+	if(cache.valid)
+	{
+		response_cache_hits++;
+		responseWrite(cache.data, cache.length);
+		return true;
+	}
+
+	response_cache_misses++;
+
+	cache.length = 0;
+	response_cache = &cache;
+
+	return false;
+}
+
+void responseCacheStore()
+{
+	if(response_cache)
+		response_cache->valid = true;
+
+	response_cache = NULL;
+}
+
+void responseCacheInvalidate(struct ResponseCache &cache)
+{
+	cache.valid = false;
+	cache.length = 0;
+}
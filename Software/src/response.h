@@ -0,0 +1,70 @@
+#ifndef RESPONSE_h
+#define RESPONSE_h
+
+#include "Arduino.h"
+
+// http responses rendered with responseWrite*(). two ways to send them:
+// - responseBegin(), any number of responseWrite*() calls, responseEnd(): the body is passed to the server through
+//   a small static buffer, but the server keeps all of it in the heap until it has been sent (bodies of a few kB)
+// - responseSendParts(): long bodies are rendered part by part while the TCP stack sends them, a response needs
+//   RESPONSE_PART_LENGTH bytes of heap no matter how long it is
+
+#define RESPONSE_BUFFER_LENGTH 256
+// maximum length of one part, longer parts are cut off (response_part_overflows)
+#define RESPONSE_PART_LENGTH 512
+
+// position of a response that is sent in parts. the renderer runs after the request handler has returned,
+// the request args it needs are kept in the other fields (their meaning depends on the renderer)
+struct ResponseCursor
+{
+	// part to render, counts up from 0
+	uint32_t part;
+	uint32_t index;
+	int64_t from;
+	int64_t to;
+	uint8_t option;
+};
+
+// writes the part cursor.part with responseWrite*() (nothing if it is empty), returns false once there are no parts left
+typedef bool (*ResponseRenderer)(struct ResponseCursor &cursor);
+
+void responseSendParts(int code, const char *content_type, ResponseRenderer render, const struct ResponseCursor &cursor);
+
+extern uint32_t response_part_overflows;
+
+void responseBegin(int code, const char *content_type);
+void responseWrite(const char *data, size_t length);
+void responseWrite(const char *text);
+void responseWrite(const String &text);
+void responseWrite(char c);
+void responseWriteInteger(int64_t value);
+// numerator / denominator with decimals fractional digits, see formatFixed()
+void responseWriteFixed(int64_t numerator, int64_t denominator, uint8_t decimals);
+void responseWriteHex(uint32_t value);
+// sends the rest of the buffer and finishes the response
+void responseEnd();
+
+// a rendered part of a response, kept until the content it was rendered from changes
+struct ResponseCache
+{
+	char *data;
+	uint16_t capacity;
+	uint16_t length;
+	// false until the part has been rendered completely after the last responseCacheInvalidate()
+	bool valid;
+};
+
+// requests of the cached pages (/metrics and /metricsnew, see metrics.h) answered from their cache or rendered.
+// /allmetrics, including the harmonics, is never cached and does not count
+extern uint32_t response_cache_hits;
+extern uint32_t response_cache_misses;
+// renderings that did not fit into their cache
+extern uint32_t response_cache_overflows;
+
+// writes the cached part and returns true if the cache is valid. otherwise returns false and everything written
+// until responseCacheStore() is recorded into the cache as well, the caller has to render the part then
+bool responseWriteCached(struct ResponseCache &cache);
+void responseCacheStore();
+void responseCacheInvalidate(struct ResponseCache &cache);
+
+#endif
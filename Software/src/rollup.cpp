@@ -0,0 +1,197 @@
+#include "Arduino.h"
+#include "hal.h"
+#include "rollup.h"
+#include "format.h"
+
+// 5 min of 10 s buckets, 30 min of 1 min buckets, 4 h of 15 min buckets
+const struct RollupLevel rollup_levels[ROLLUP_LEVELS] = {
+	{"10s", 10, 30, 0},
+	{"1m", 60, 30, 30},
+	{"15m", 900, 16, 60}
+};
+
+// open bucket of every level and value, of the encoded values (65535 * 32768 still fits the sum)
+struct RollupAccumulator
+{
+	int32_t sum;
+	// 15 min of 100 ms samples = 9000
+	uint16_t count;
+	int16_t min;
+	int16_t max;
+};
+
+struct RollupEncoding
+{
+	uint8_t shift;
+	uint16_t offset;
+};
+
+struct RollupEncoding rollup_encoding[ROLLUP_VALUES_MAX];
+
+struct RollupAccumulator rollup_open[ROLLUP_LEVELS][ROLLUP_VALUES_MAX];
+uint32_t rollup_open_start[ROLLUP_LEVELS];
+
+// closed buckets of all levels, one ring per level starting at rollup_levels[level].first
+// (structure of arrays, index = bucket * ROLLUP_VALUES_MAX + value). min > max if there was no sample
+int16_t rollup_avg[ROLLUP_BUCKETS * ROLLUP_VALUES_MAX];
+int16_t rollup_min[ROLLUP_BUCKETS * ROLLUP_VALUES_MAX];
+int16_t rollup_max[ROLLUP_BUCKETS * ROLLUP_VALUES_MAX];
+uint32_t rollup_start[ROLLUP_BUCKETS];
+uint8_t rollup_head[ROLLUP_LEVELS];
+uint8_t rollup_count[ROLLUP_LEVELS];
+
+uint8_t rollup_value_count = 0;
+
+unsigned long rollup_last_ms = 0;
+uint32_t rollup_seconds = 0;
+
+uint32_t rollupSeconds()
+{
+	unsigned long elapsed = halMillis() - rollup_last_ms;
+
+	rollup_seconds += elapsed / 1000;
+	rollup_last_ms += (elapsed / 1000) * 1000;
+
+	return rollup_seconds;
+}
+
+void resetAccumulators(uint8_t level)
+{
+	for(uint8_t index = 0; index < rollup_value_count; index++)
+		rollup_open[level][index].count = 0;
+}
+
+void initRollups(uint8_t value_count)
+{
+	rollup_value_count = min(value_count, (uint8_t)ROLLUP_VALUES_MAX);
+
+	uint32_t now = rollupSeconds();
+
+	for(uint8_t level = 0; level < ROLLUP_LEVELS; level++)
+	{
+		rollup_head[level] = 0;
+		rollup_count[level] = 0;
+		rollup_open_start[level] = now - now % rollup_levels[level].interval_s;
+
+		resetAccumulators(level);
+	}
+}
+
+void rollupEncoding(uint8_t index, uint8_t shift, bool is_unsigned)
+{
+	if(index >= ROLLUP_VALUES_MAX)
+		return;
+
+	rollup_encoding[index].shift = shift;
+	rollup_encoding[index].offset = is_unsigned ? 0x8000 : 0;
+}
+
+int16_t rollupEncode(uint8_t index, int32_t value)
+{
+	const struct RollupEncoding &encoding = rollup_encoding[index];
+
+	if(encoding.shift)
+		value = (value + (1 << (encoding.shift - 1))) >> encoding.shift;
+
+	return constrain(value - encoding.offset, (int32_t)-32768, (int32_t)32767);
+}
+
+int32_t rollupDecode(uint8_t index, int16_t value)
+{
+	const struct RollupEncoding &encoding = rollup_encoding[index];
+
+	return (value + encoding.offset) * (1 << encoding.shift);
+}
+
+void rollupAdd(uint8_t index, int32_t raw)
+{
+	if(index >= rollup_value_count)
+		return;
+
+	int16_t value = rollupEncode(index, raw);
+
+	for(uint8_t level = 0; level < ROLLUP_LEVELS; level++)
+	{
+		struct RollupAccumulator &open = rollup_open[level][index];
+
+		if(!open.count)
+		{
+			open.sum = 0;
+			open.min = value;
+			open.max = value;
+		}
+
+		if(open.count == 0xFFFF)
+			continue;
+
+		open.sum += value;
+		open.count++;
+		open.min = min(open.min, value);
+		open.max = max(open.max, value);
+	}
+}
+
+void rollupUpdate()
+{
+	uint32_t now = rollupSeconds();
+
+	for(uint8_t level = 0; level < ROLLUP_LEVELS; level++)
+	{
+		const struct RollupLevel &info = rollup_levels[level];
+
+		if((now - rollup_open_start[level]) < info.interval_s)
+			continue;
+
+		uint8_t bucket = info.first + rollup_head[level];
+		uint16_t offset = bucket * ROLLUP_VALUES_MAX;
+
+		rollup_start[bucket] = rollup_open_start[level];
+
+		for(uint8_t index = 0; index < rollup_value_count; index++)
+		{
+			const struct RollupAccumulator &open = rollup_open[level][index];
+
+			if(open.count)
+			{
+				rollup_avg[offset + index] = divideRounded(open.sum, open.count);
+				rollup_min[offset + index] = open.min;
+				rollup_max[offset + index] = open.max;
+			}
+			else
+			{
+				rollup_min[offset + index] = 32767;
+				rollup_max[offset + index] = -32768;
+			}
+		}
+
+		rollup_head[level] = (rollup_head[level] + 1) % info.length;
+		if(rollup_count[level] < info.length)
+			rollup_count[level]++;
+
+		// intervals without any sample are not stored
+		rollup_open_start[level] = now - now % info.interval_s;
+		resetAccumulators(level);
+	}
+}
+
+uint8_t rollupCount(uint8_t level)
+{
+	return rollup_count[level];
+}
+
+bool rollupBucket(uint8_t level, uint8_t age, uint8_t index, struct RollupBucket &bucket)
+{
+	if((age >= rollup_count[level]) || (index >= rollup_value_count))
+		return false;
+
+	const struct RollupLevel &info = rollup_levels[level];
+	uint8_t position = info.first + (rollup_head[level] + info.length - 1 - age) % info.length;
+	uint16_t offset = position * ROLLUP_VALUES_MAX + index;
+
+	bucket.start_s = rollup_start[position];
+	bucket.avg = rollupDecode(index, rollup_avg[offset]);
+	bucket.min = rollupDecode(index, rollup_min[offset]);
+	bucket.max = rollupDecode(index, rollup_max[offset]);
+
+	return rollup_min[offset] <= rollup_max[offset];
+}
@@ -0,0 +1,51 @@
+#ifndef ROLLUP_h
+#define ROLLUP_h
+
+// avg / min / max of the showInMain values at coarser resolutions than the sample buffers.
+// every sample updates the open bucket of all resolutions, a bucket is closed into its ring
+// when the first sample after its end arrives. bucket times are seconds since boot (rollupSeconds()).
+// values are kept as 16 bits, see rollupEncoding()
+
+#define ROLLUP_LEVELS 3
+// number of buckets of all levels
+#define ROLLUP_BUCKETS 76
+#define ROLLUP_VALUES_MAX 12
+
+struct RollupLevel
+{
+	// resolution name used by the query endpoint
+	const char *name;
+	uint16_t interval_s;
+	// number of buckets and position of the first one in the bucket store
+	uint8_t length;
+	uint8_t first;
+};
+
+extern const struct RollupLevel rollup_levels[ROLLUP_LEVELS];
+
+struct RollupBucket
+{
+	uint32_t start_s;
+	// raw values
+	int32_t avg;
+	int32_t min;
+	int32_t max;
+};
+
+void initRollups(uint8_t value_count);
+// a value is stored without its lowest shift bits (e.g. 8 for values with an LSB register, which leaves the 16 bit
+// register), unsigned values are moved into the range of int16
+void rollupEncoding(uint8_t index, uint8_t shift, bool is_unsigned);
+// account one raw sample of a value
+void rollupAdd(uint8_t index, int32_t value);
+// close buckets whose interval has ended, call before rollupAdd()
+void rollupUpdate();
+// seconds since boot, does not wrap with halMillis()
+uint32_t rollupSeconds();
+
+// number of closed buckets of a level and a bucket by age (0 = newest), false if there was no sample of the value
+// in the bucket
+uint8_t rollupCount(uint8_t level);
+bool rollupBucket(uint8_t level, uint8_t age, uint8_t index, struct RollupBucket &bucket);
+
+#endif
@@ -0,0 +1,135 @@
+#include "Arduino.h"
+#include "hal.h"
+#include "sampler.h"
+#include "metrics.h"
+#include "settings.h"
+
+bool sampling_synchronous = false;
+uint32_t zero_crossing_count = 0;
+
+// zero crossing count at which the next sample of every tier is due
+uint32_t zero_crossing_next_tick[TIER_COUNT];
+unsigned long zero_crossing_last_change = 0;
+
+// time at which the next sample of every tier is due (timer based sampling). the ticks stay on a fixed grid,
+// ticks that were missed completely are skipped and counted instead of being sampled back to back
+unsigned long tier_next_tick_ms[TIER_COUNT];
+uint32_t sample_ticks_missed[TIER_COUNT];
+// the schedule starts with the next handleSampling(), not while setup() is still busy
+bool sampling_restart = true;
+
+// line cycles per sample of a tier, setting_zx_cycles applies to the normal tier
+uint32_t tierCycles(uint8_t tier)
+{
+	uint32_t cycles = (uint32_t)setting_zx_cycles * sample_tiers[tier].interval_ms / SAMPLE_INTERVAL_MS;
+
+	return cycles ? cycles : 1;
+}
+
+void initSampling()
+{
+	halZeroCrossingBegin(setting_zx_pin);
+
+	sampling_synchronous = false;
+	zero_crossing_count = 0;
+	zero_crossing_last_change = halMillis();
+
+	for(uint8_t tier = 0; tier < TIER_COUNT; tier++)
+		zero_crossing_next_tick[tier] = 0;
+
+	sampling_restart = true;
+}
+
+// sample every tier on every tierCycles()'th zero crossing, so every sample covers whole line cycles
+// returns false if no zero crossings are coming in. resync: sampling was restarted or timer based until now, the zero crossing
+// ticks that passed meanwhile were not missed
+bool handleSamplingSynchronous(unsigned long now, bool resync)
+{
+	uint32_t count;
+	unsigned long time_us;
+
+	halZeroCrossingRead(count, time_us);
+
+	if(count != zero_crossing_count)
+	{
+		zero_crossing_count = count;
+		zero_crossing_last_change = now;
+	}
+
+	if((now - zero_crossing_last_change) > ZERO_CROSSING_TIMEOUT_MS)
+		return false;
+
+	uint8_t tiers = 0;
+
+	for(uint8_t tier = 0; tier < TIER_COUNT; tier++)
+	{
+		if((int32_t)(count - zero_crossing_next_tick[tier]) < 0)
+			continue;
+
+		// stay on multiples of the tier's cycles, intervals that were missed completely are skipped
+		uint32_t cycles = tierCycles(tier);
+		uint32_t missed = (count - zero_crossing_next_tick[tier]) / cycles;
+
+		if(!resync)
+			sample_ticks_missed[tier] += missed;
+
+		zero_crossing_next_tick[tier] += cycles * (1 + missed);
+		// continue on time if the zero crossings stop
+		tier_next_tick_ms[tier] = now + sample_tiers[tier].interval_ms;
+
+		tiers |= 1 << tier;
+	}
+
+	startMetricsRead(tiers, time_us, count);
+
+	return true;
+}
+
+void handleSampling()
+{
+	// finish the current sample before scheduling the next one
+	if(metricsReadBusy())
+	{
+		continueMetricsRead(SAMPLE_SLICE_BUDGET_US);
+		return;
+	}
+
+	unsigned long now = halMillis();
+
+	// the first sample of every tier is taken right away
+	if(sampling_restart)
+	{
+		for(uint8_t tier = 0; tier < TIER_COUNT; tier++)
+			tier_next_tick_ms[tier] = now;
+	}
+
+	if(setting_zx_pin >= 0)
+		sampling_synchronous = handleSamplingSynchronous(now, sampling_restart || !sampling_synchronous);
+
+	sampling_restart = false;
+
+	if(!sampling_synchronous)
+	{
+		uint8_t tiers = 0;
+
+		for(uint8_t tier = 0; tier < TIER_COUNT; tier++)
+		{
+			unsigned long interval = sample_tiers[tier].interval_ms;
+
+			if((long)(now - tier_next_tick_ms[tier]) < 0)
+				continue;
+
+			// overrun: a stall of more than one interval skips the ticks in between
+			unsigned long missed = (now - tier_next_tick_ms[tier]) / interval;
+
+			sample_ticks_missed[tier] += missed;
+			tier_next_tick_ms[tier] += (missed + 1) * interval;
+			tiers |= 1 << tier;
+		}
+
+		startMetricsRead(tiers, halMicros(), 0);
+	}
+
+	// the first slice is read right away
+	continueMetricsRead(SAMPLE_SLICE_BUDGET_US);
+}
@@ -0,0 +1,17 @@
+#ifndef SAMPLER_h
+#define SAMPLER_h
+
+void initSampling();
+void handleSampling();
+
+// true while samples are synchronized to the zero crossing input
+extern bool sampling_synchronous;
+// zero crossings seen since initSampling()
+extern uint32_t zero_crossing_count;
+// ticks of every tier that were skipped because sampling was late by a whole interval or more
+extern uint32_t sample_ticks_missed[];
+
+// fall back to timer based sampling when no zero crossing was seen for this long
+#define ZERO_CROSSING_TIMEOUT_MS 1000
+
+#endif
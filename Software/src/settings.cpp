@@ -1,12 +1,18 @@
 #include <climits>
 #include <cstdio>
 
-#include "web.h"
+#include "hal.h"
 #include "fram.h"
 #include "settings.h"
 #include "metrics.h"
 #include "globals.h"
 #include "ATM90E36.h"
+#include "sampler.h"
+#include "response.h"
+#include "pages.h"
+#include "push.h"
+#include "influx.h"
+#include "mqtt.h"
 
 enum SettingsType
 {
@@ -14,6 +20,21 @@ enum SettingsType
 	STRING = 1
 };
 
+// what has to be updated when a setting is changed (bit mask)
+#define APPLY_NONE 0
+// write the changed ATM90E36 configuration / calibration registers
+#define APPLY_CHIP (1 << 0)
+// restart the sampling schedule
+#define APPLY_SAMPLING (1 << 1)
+// samples taken with the old value are no longer comparable, refill the sample buffers
+#define APPLY_BUFFERS (1 << 2)
+// parse the UDP push target
+#define APPLY_PUSH (1 << 3)
+// parse the influx push settings and retry right away
+#define APPLY_INFLUX (1 << 4)
+// reconnect to the MQTT broker
+#define APPLY_MQTT (1 << 5)
+
 struct Setting
 {
 	// setting address in eeprom (multiplied by four to obtain hardware address)
@@ -34,8 +55,13 @@ struct Setting
 	}value_default;
 	// pointer to value
 	void *value;
+	// APPLY_* flags
+	uint8_t apply;
 };
 
+// APPLY_* flags of the settings changed since the last handleSettings()
+uint8_t settings_apply_pending = APPLY_NONE;
+
 // max string length I2C buffer length - 2
 // also subtract one for terminating 0x00
 #define MAX_STRING_LENGTH 30
@@ -44,6 +70,24 @@ int64_t setting_energy_total[4];
 
 int64_t setting_sample_count;
 
+int64_t setting_zx_pin;
+int64_t setting_zx_cycles;
+
+int64_t setting_push_format;
+int64_t setting_push_port;
+int64_t setting_push_interval;
+
+int64_t setting_influx_interval;
+int64_t setting_influx_batch;
+int64_t setting_influx_port;
+
+int64_t setting_mqtt_port;
+int64_t setting_mqtt_qos;
+int64_t setting_mqtt_keepalive;
+int64_t setting_mqtt_format;
+int64_t setting_mqtt_interval;
+int64_t setting_mqtt_inflight;
+
 int64_t setting_voltage_gain[3];
 int64_t setting_current_gain[3];
 
@@ -57,6 +101,11 @@ char setting_wifi_ip_fixed[MAX_STRING_LENGTH];
 char setting_wifi_ip_gateway[MAX_STRING_LENGTH];
 char setting_wifi_ip_netmask[MAX_STRING_LENGTH];
 
+char setting_push_target[MAX_STRING_LENGTH];
+char setting_influx_host[MAX_STRING_LENGTH];
+char setting_influx_path[MAX_STRING_LENGTH];
+char setting_mqtt_host[MAX_STRING_LENGTH];
+
 char setting_metric_name_default[MAX_STRING_LENGTH] = "threephase";
 char setting_location_tag_default[MAX_STRING_LENGTH] = "main";
 char setting_wifi_ssid_default[MAX_STRING_LENGTH] = "";
@@ -67,34 +116,69 @@ char setting_wifi_ip_fixed_default[MAX_STRING_LENGTH] = "";
 char setting_wifi_ip_gateway_default[MAX_STRING_LENGTH] = "";
 char setting_wifi_ip_netmask_default[MAX_STRING_LENGTH] = "";
 
+char setting_push_target_default[MAX_STRING_LENGTH] = "192.168.2.91";
+char setting_influx_host_default[MAX_STRING_LENGTH] = "";
+char setting_influx_path_default[MAX_STRING_LENGTH] = "/write?db=threephase";
+char setting_mqtt_host_default[MAX_STRING_LENGTH] = "";
+
 struct Setting settings[] = {
-	{0x00, "totT", "total energy all phases", INTEGER, LLONG_MAX, LLONG_MIN + 1,        {0},    setting_energy_total},
-	{0x01, "totA", "total energy phase A",    INTEGER, LLONG_MAX, LLONG_MIN + 1,        {0},    setting_energy_total + 1},
-	{0x02, "totB", "total energy phase B",    INTEGER, LLONG_MAX, LLONG_MIN + 1,        {0},    setting_energy_total + 2},
-	{0x03, "totC", "total energy phase C",    INTEGER, LLONG_MAX, LLONG_MIN + 1,        {0},    setting_energy_total + 3},
-
-	{0x10, "buff",  "sample buffer size (0.5s interval)",  INTEGER, SAMPLE_COUNT_MAX, 1, {1}, &setting_sample_count},
-
-	{0x21, "ugnA", "voltage gain phase A", INTEGER, ((2<<16)-1), 0,           {13285},    setting_voltage_gain},
-	{0x22, "ugnB", "voltage gain phase B", INTEGER, ((2<<16)-1), 0,           {13251},    setting_voltage_gain + 1},
-	{0x23, "ugnC", "voltage gain phase C", INTEGER, ((2<<16)-1), 0,           {13250},    setting_voltage_gain + 2},
-
-	{0x28, "ignA", "current gain phase A", INTEGER, ((2<<16)-1), 0,           {20132},    setting_current_gain},
-	{0x29, "ignB", "current gain phase B", INTEGER, ((2<<16)-1), 0,           {20328},    setting_current_gain + 1},
-	{0x2A, "ignC", "current gain phase C", INTEGER, ((2<<16)-1), 0,           {20333},    setting_current_gain + 2},
-
-	{0xA0, "meas", "metric name",           STRING, MAX_STRING_LENGTH - 1, 2, {.as_str = setting_metric_name_default},   setting_metric_name},
-	{0xA8, "loc",  "location tag",          STRING, MAX_STRING_LENGTH - 1, 2, {.as_str = setting_location_tag_default},  setting_location_tag},
-	{0xB0, "ssid", "WIFI SSID",             STRING, MAX_STRING_LENGTH - 1, 0, {.as_str = setting_wifi_ssid_default},     setting_wifi_ssid},
-	{0xB8, "psk",  "WIFI PSK (hidden)",     STRING, MAX_STRING_LENGTH - 1, 0, {.as_str = setting_wifi_psk_default},      setting_wifi_psk},
-	{0xC0, "host", "hostname",              STRING, MAX_STRING_LENGTH - 1, 2, {.as_str = setting_wifi_hostname_default}, setting_wifi_hostname},
-
-	{0xC8, "ipf",  "fixed IP address (blank = DHCP)", STRING, MAX_STRING_LENGTH - 1, 2, {.as_str = setting_wifi_ip_fixed_default},   setting_wifi_ip_fixed},
-	{0xD0, "ipg",  "gateway address",                 STRING, MAX_STRING_LENGTH - 1, 2, {.as_str = setting_wifi_ip_gateway_default}, setting_wifi_ip_gateway},
-	{0xD8, "netm", "netmask",                         STRING, MAX_STRING_LENGTH - 1, 2, {.as_str = setting_wifi_ip_netmask_default}, setting_wifi_ip_netmask},
+	{0x00, "totT", "total energy all phases", INTEGER, LLONG_MAX, LLONG_MIN + 1,        {0},    setting_energy_total,     APPLY_NONE},
+	{0x01, "totA", "total energy phase A",    INTEGER, LLONG_MAX, LLONG_MIN + 1,        {0},    setting_energy_total + 1, APPLY_NONE},
+	{0x02, "totB", "total energy phase B",    INTEGER, LLONG_MAX, LLONG_MIN + 1,        {0},    setting_energy_total + 2, APPLY_NONE},
+	{0x03, "totC", "total energy phase C",    INTEGER, LLONG_MAX, LLONG_MIN + 1,        {0},    setting_energy_total + 3, APPLY_NONE},
+
+	{0x10, "buff",  "sample buffer size (0.5s interval)",  INTEGER, SAMPLE_COUNT_MAX, 1, {1}, &setting_sample_count, APPLY_BUFFERS},
+
+	{0x11, "zxp",   "zero crossing GPIO (-1 = timer sampling)",          INTEGER, 15, -1,  {-1}, &setting_zx_pin,    APPLY_CHIP | APPLY_SAMPLING | APPLY_BUFFERS},
+	{0x12, "zxc",   "line cycles per sample (zero crossing sampling)",   INTEGER, 250, 1,  {25}, &setting_zx_cycles, APPLY_SAMPLING | APPLY_BUFFERS},
+
+	{0x13, "pfmt",  "UDP push format (0 = text, 1 = binary)",            INTEGER, 1, 0,    {0},  &setting_push_format, APPLY_NONE},
+	{0x14, "pprt",  "UDP push port",                                     INTEGER, 65535, 1, {8001}, &setting_push_port, APPLY_PUSH},
+	{0x15, "pint",  "UDP push samples per datagram (0.5s, text fits 2)", INTEGER, PUSH_INTERVAL_MAX, 1, {2}, &setting_push_interval, APPLY_PUSH},
+
+	{0x16, "iint",  "InfluxDB push interval (seconds per record)",       INTEGER, 3600, 1, {30}, &setting_influx_interval, APPLY_NONE},
+	{0x17, "ibat",  "InfluxDB records per POST",                         INTEGER, INFLUX_BATCH_MAX, 1, {INFLUX_BATCH_MAX}, &setting_influx_batch, APPLY_NONE},
+	{0x18, "iprt",  "InfluxDB server port",                              INTEGER, 65535, 1, {8086}, &setting_influx_port, APPLY_INFLUX},
+
+	{0x19, "mprt",  "MQTT broker port",                                  INTEGER, 65535, 1, {1883}, &setting_mqtt_port, APPLY_MQTT},
+	{0x1A, "mqos",  "MQTT QoS (0 or 1)",                                 INTEGER, 1, 0,    {0},  &setting_mqtt_qos, APPLY_NONE},
+	{0x1B, "mkal",  "MQTT keepalive (seconds)",                          INTEGER, 600, 5,  {60}, &setting_mqtt_keepalive, APPLY_MQTT},
+	{0x1C, "mfmt",  "MQTT format (0 = JSON object, 1 = topic per value)", INTEGER, 1, 0,   {0},  &setting_mqtt_format, APPLY_NONE},
+	{0x1D, "mint",  "MQTT publish interval (samples of 0.5s)",           INTEGER, MQTT_INTERVAL_MAX, 1, {2}, &setting_mqtt_interval, APPLY_NONE},
+	{0x1E, "mfli",  "MQTT QoS 1 messages in flight",                     INTEGER, MQTT_INFLIGHT_MAX, 1, {4}, &setting_mqtt_inflight, APPLY_NONE},
+
+	{0x21, "ugnA", "voltage gain phase A", INTEGER, ((2<<16)-1), 0,           {13285},    setting_voltage_gain,     APPLY_CHIP | APPLY_BUFFERS},
+	{0x22, "ugnB", "voltage gain phase B", INTEGER, ((2<<16)-1), 0,           {13251},    setting_voltage_gain + 1, APPLY_CHIP | APPLY_BUFFERS},
+	{0x23, "ugnC", "voltage gain phase C", INTEGER, ((2<<16)-1), 0,           {13250},    setting_voltage_gain + 2, APPLY_CHIP | APPLY_BUFFERS},
+
+	{0x28, "ignA", "current gain phase A", INTEGER, ((2<<16)-1), 0,           {20132},    setting_current_gain,     APPLY_CHIP | APPLY_BUFFERS},
+	{0x29, "ignB", "current gain phase B", INTEGER, ((2<<16)-1), 0,           {20328},    setting_current_gain + 1, APPLY_CHIP | APPLY_BUFFERS},
+	{0x2A, "ignC", "current gain phase C", INTEGER, ((2<<16)-1), 0,           {20333},    setting_current_gain + 2, APPLY_CHIP | APPLY_BUFFERS},
+
+	{0xA0, "meas", "metric name",           STRING, MAX_STRING_LENGTH - 1, 2, {.as_str = setting_metric_name_default},   setting_metric_name,   APPLY_MQTT},
+	{0xA8, "loc",  "location tag",          STRING, MAX_STRING_LENGTH - 1, 2, {.as_str = setting_location_tag_default},  setting_location_tag,  APPLY_MQTT},
+	{0xB0, "ssid", "WIFI SSID",             STRING, MAX_STRING_LENGTH - 1, 0, {.as_str = setting_wifi_ssid_default},     setting_wifi_ssid,     APPLY_NONE},
+	{0xB8, "psk",  "WIFI PSK (hidden)",     STRING, MAX_STRING_LENGTH - 1, 0, {.as_str = setting_wifi_psk_default},      setting_wifi_psk,      APPLY_NONE},
+	{0xC0, "host", "hostname",              STRING, MAX_STRING_LENGTH - 1, 2, {.as_str = setting_wifi_hostname_default}, setting_wifi_hostname, APPLY_NONE},
+
+	{0xC8, "ipf",  "fixed IP address (blank = DHCP)", STRING, MAX_STRING_LENGTH - 1, 2, {.as_str = setting_wifi_ip_fixed_default},   setting_wifi_ip_fixed,   APPLY_NONE},
+	{0xD0, "ipg",  "gateway address",                 STRING, MAX_STRING_LENGTH - 1, 2, {.as_str = setting_wifi_ip_gateway_default}, setting_wifi_ip_gateway, APPLY_NONE},
+	{0xD8, "netm", "netmask",                         STRING, MAX_STRING_LENGTH - 1, 2, {.as_str = setting_wifi_ip_netmask_default}, setting_wifi_ip_netmask, APPLY_NONE},
+
+	{0xE0, "ptgt", "UDP push target IP address (0.0.0.0 = no push)", STRING, 15, 7, {.as_str = setting_push_target_default}, setting_push_target, APPLY_PUSH},
+	{0xE4, "ihst", "InfluxDB server host (blank = no push)",          STRING, MAX_STRING_LENGTH - 1, 0, {.as_str = setting_influx_host_default}, setting_influx_host, APPLY_INFLUX},
+	{0xE8, "ipth", "InfluxDB write path",                             STRING, MAX_STRING_LENGTH - 1, 1, {.as_str = setting_influx_path_default}, setting_influx_path, APPLY_INFLUX},
+	{0xEC, "mhst", "MQTT broker host (blank = no MQTT)",              STRING, MAX_STRING_LENGTH - 1, 0, {.as_str = setting_mqtt_host_default}, setting_mqtt_host, APPLY_MQTT},
 };
 #define SETTINGS_COUNT ((int32_t)(sizeof(settings)/sizeof(settings[0])))
 
+// offset added to an integer setting when stored in FRAM
+// the zero crossing pin is stored as pin + 1 so a blank (zeroed) block means timer sampling and not GPIO0
+int64_t settingFramOffset(uint8_t index_setting)
+{
+	return (settings[index_setting].value == &setting_zx_pin) ? 1 : 0;
+}
+
 void initSettings()
 {
 	for(uint8_t index_setting = 0; index_setting < SETTINGS_COUNT; index_setting++)
@@ -103,6 +187,7 @@ void initSettings()
 		{
 			int64_t value_eeprom;
 			readFram((uint8_t*)(&value_eeprom), settings[index_setting].address, sizeof(value_eeprom));
+			value_eeprom -= settingFramOffset(index_setting);
 
 			if((value_eeprom >= settings[index_setting].min) && (value_eeprom <= settings[index_setting].max))
 				*((int64_t*)settings[index_setting].value) = value_eeprom;
@@ -113,6 +198,9 @@ void initSettings()
 		{
 			readFram((uint8_t*)settings[index_setting].value, settings[index_setting].address, MAX_STRING_LENGTH);
 
+			// blank or corrupted FRAM might not contain a terminating 0x00
+			((char*)settings[index_setting].value)[MAX_STRING_LENGTH - 1] = 0;
+
 			int length = strlen((char*)settings[index_setting].value);
 
 			if ((length < settings[index_setting].min) || (length > settings[index_setting].max))
@@ -125,7 +213,8 @@ void save_setting(uint8_t index_setting)
 {
 	if(settings[index_setting].type == INTEGER)
 	{
-		writeFram((uint8_t*)settings[index_setting].value, settings[index_setting].address, sizeof(int64_t));
+		int64_t value_eeprom = *((int64_t*)settings[index_setting].value) + settingFramOffset(index_setting);
+		writeFram((uint8_t*)(&value_eeprom), settings[index_setting].address, sizeof(value_eeprom));
 	}
 	else if(settings[index_setting].type == STRING)
 	{
@@ -135,108 +224,126 @@ void save_setting(uint8_t index_setting)
 
 void handleSettingsGet()
 {
-	message_buffer.remove(0);
+	halHttpSendStatic(200, "text/html", page_settings_html, sizeof(page_settings_html));
+}
 
-	message_buffer +=
-	"<html>"
-		"<body>"
-			"<h1>Settings</h1>"
-			"<table>"
-				"<tr>"
-					"<th>Name</th>"
-					"<th>Value</th>"
-					"<th>Default</th>"
-					"<th>Min</th>"
-					"<th>Max</th>"
-				"</tr>";
+// write text as a JSON string
+void writeJsonString(const char *text)
+{
+	responseWrite('"');
 
-	for(uint8_t index_setting = 0; index_setting < SETTINGS_COUNT; index_setting++)
+	for(; *text; text++)
 	{
-		message_buffer +=
-		String("<tr>") +
-			"<td>" + settings[index_setting].name + "</td>"
-			"<td>";
-
-		if(settings[index_setting].type == INTEGER)
+		if((*text == '"') || (*text == '\\'))
 		{
-			int64_t value = *((int64_t*)settings[index_setting].value);
-
-			message_buffer += int64_to_string(value);
+			responseWrite('\\');
+			responseWrite(*text);
 		}
-		else if (settings[index_setting].type == STRING)
+		else if((uint8_t)*text < 0x20)
 		{
-			if (settings[index_setting].value == setting_wifi_psk)	// hide wifi psk
-			{
-				uint8_t counter = strlen((char*)settings[index_setting].value);
-				while(counter--)
-					message_buffer += "*";
-			}
-			else
-			{
-				message_buffer += String((char*)settings[index_setting].value);
-			}
+			responseWrite("\\u00");
+			if((uint8_t)*text < 0x10)
+				responseWrite('0');
+			responseWriteHex(*text);
 		}
+		else
+			responseWrite(*text);
+	}
 
-		message_buffer +=
-			"</td>"
-			"<td>";
+	responseWrite('"');
+}
 
-		if(settings[index_setting].type == INTEGER)
-		{
-			message_buffer += int64_to_string(settings[index_setting].value_default.as_int);
-		}
-		else if (settings[index_setting].type == STRING)
-		{
-			message_buffer += String(settings[index_setting].value_default.as_str);
-		}
-		message_buffer +=
-			"</td>"
-			"<td>" + int64_to_string(settings[index_setting].min) + "</td>"
-			"<td>" + int64_to_string(settings[index_setting].max) + "</td>"
-		"</tr>";
+// integers are sent as strings as well, int64 does not fit into a JSON number without losing precision
+void writeJsonInteger(int64_t value)
+{
+	responseWrite('"');
+	responseWriteInteger(value);
+	responseWrite('"');
+}
+
+// part 0 opens the list, then one setting per part and the end of the list
+bool renderSettingsJson(struct ResponseCursor &cursor)
+{
+	if(!cursor.part)
+	{
+		responseWrite("{\"settings\":[");
+		return true;
 	}
 
-	message_buffer +=
-			"</table>"
-			"<form method=\"post\">"
-				"<select name=\"id\">"
-					"<option value=\"--\">---</option>";
+	if(cursor.part > SETTINGS_COUNT + 1)
+		return false;
 
-	for(uint8_t index_setting = 0; index_setting < SETTINGS_COUNT; index_setting++)
+	if(cursor.part == SETTINGS_COUNT + 1)
 	{
-		message_buffer += "<option value=\"";
-		message_buffer += String(settings[index_setting].abbrev);
-		message_buffer += "\">";
-		message_buffer += settings[index_setting].name;
-		message_buffer += "</option>";
+		responseWrite("]}");
+		return true;
 	}
 
-	message_buffer +=
-				"</select>"
-				"<input name=\"value\">"
-				"<input type=\"submit\" value=\"Save\">"
-				"<input type=\"hidden\" name=\"backurl\" id=\"backurl_element\"/>"
-			"</form>"
-			"<p>wifi settings are only applied after restarting the meter</p>"
-		"</body>"
-		SCRIPT_SET_BACKURL
-	"</html>";
-
-	httpServer.send(200, "text/html", message_buffer);
+	uint8_t index_setting = cursor.part - 1;
+	const struct Setting &setting = settings[index_setting];
+
+	if(index_setting)
+		responseWrite(',');
+
+	responseWrite("{\"id\":");
+	writeJsonString(setting.abbrev);
+	responseWrite(",\"name\":");
+	writeJsonString(setting.name);
+
+	responseWrite(",\"value\":");
+	if(setting.type == INTEGER)
+	{
+		writeJsonInteger(*((int64_t*)setting.value));
+	}
+	else if(setting.value == setting_wifi_psk)	// hide wifi psk
+	{
+		uint8_t counter = strlen((char*)setting.value);
+
+		responseWrite('"');
+		while(counter--)
+			responseWrite('*');
+		responseWrite('"');
+	}
+	else
+	{
+		writeJsonString((char*)setting.value);
+	}
+
+	responseWrite(",\"default\":");
+	if(setting.type == INTEGER)
+		writeJsonInteger(setting.value_default.as_int);
+	else
+		writeJsonString(setting.value_default.as_str);
+
+	responseWrite(",\"min\":");
+	writeJsonInteger(setting.min);
+	responseWrite(",\"max\":");
+	writeJsonInteger(setting.max);
+	responseWrite('}');
+
+	return true;
+}
+
+void handleSettingsJson()
+{
+	struct ResponseCursor cursor = {};
+
+	responseSendParts(200, "application/json", renderSettingsJson, cursor);
 }
 
 void handleSettingsPost()
 {
 	message_buffer.remove(0);
 
-	if((!httpServer.hasArg("id")) || (!httpServer.hasArg("value")))
+	if((!halHttpHasArg("id")) || (!halHttpHasArg("value")))
 	{
 		message_buffer += "bad request (id and value args are missing)";
-		httpServer.send(400, "text/plain", message_buffer);
+		halHttpSend(400, "text/plain", message_buffer);
+		return;
 	}
 
 	uint8_t index_setting = 0xFF;
-	String id = httpServer.arg("id");
+	String id = halHttpArg("id");
 
 	for(uint8_t index_setting_test = 0; index_setting_test < SETTINGS_COUNT; index_setting_test++)
 	{
@@ -250,11 +357,12 @@ void handleSettingsPost()
 	if(index_setting == 0xFF)
 	{
 		message_buffer += "unknown id " + id;
-		httpServer.send(400, "text/plain", message_buffer);
+		halHttpSend(400, "text/plain", message_buffer);
 		return;
 	}
 
-	String value = httpServer.arg("value");
+	String value = halHttpArg("value");
+	bool changed = false;
 
 	if(settings[index_setting].type == INTEGER)
 	{
@@ -263,17 +371,19 @@ void handleSettingsPost()
 		if(!parse_int64(value_int, value.c_str()))
 		{
 			message_buffer += "could not parse integer value";
-			httpServer.send(400, "text/plain", message_buffer);
+			halHttpSend(400, "text/plain", message_buffer);
 			return;
 		}
 
 		if((value_int < settings[index_setting].min) || (value_int > settings[index_setting].max))
 		{
 			message_buffer += "value is outside of allowed range";
-			httpServer.send(400, "text/plain", message_buffer);
+			halHttpSend(400, "text/plain", message_buffer);
 			return;
 		}
 
+		changed = (*((int64_t*)settings[index_setting].value) != value_int);
+
 		*((int64_t*)settings[index_setting].value) = value_int;
 	}
 	else if (settings[index_setting].type == STRING)
@@ -283,20 +393,50 @@ void handleSettingsPost()
 		if ((length < settings[index_setting].min) || (length > settings[index_setting].max))
 		{
 			message_buffer += "value length is outside of allowed range";
-			httpServer.send(400, "text/plain", message_buffer);
+			halHttpSend(400, "text/plain", message_buffer);
 			return;
 		}
 
+		changed = !value.equals((char*)settings[index_setting].value);
+
 		value.getBytes((uint8_t*)settings[index_setting].value, MAX_STRING_LENGTH, 0);
 	}
 
-	save_setting(index_setting);
+	if(changed)
+		save_setting(index_setting);
+
+	// metric name and location tag are part of the cached metrics
+	invalidateMetricsCache();
 
 	// send user back to settings page, 303 is important so the browser uses the Location header and switches back to a GET request
 	message_buffer += "ok";
-	httpServer.sendHeader("Location", httpServer.arg("backurl"));
-	httpServer.send(303, "text/plain", message_buffer);
+	halHttpSendHeader("Location", halHttpArg("backurl"));
+	halHttpSend(303, "text/plain", message_buffer);
+
+	if(!changed)
+		return;
 
-	initATM90E36();
-	resetMetrics();
+	// only update what depends on the setting, labels and wifi settings do not interrupt sampling.
+	// applied by handleSettings(), the request handler must not block
+	settings_apply_pending |= settings[index_setting].apply;
+}
+
+void handleSettings()
+{
+	uint8_t apply = settings_apply_pending;
+
+	settings_apply_pending = APPLY_NONE;
+
+	if(apply & APPLY_CHIP)
+		configureATM90E36();
+	if(apply & APPLY_SAMPLING)
+		initSampling();
+	if(apply & APPLY_BUFFERS)
+		resetMetrics();
+	if(apply & APPLY_PUSH)
+		configurePush();
+	if(apply & APPLY_INFLUX)
+		configureInflux();
+	if(apply & APPLY_MQTT)
+		configureMqtt();
 }
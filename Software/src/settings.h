@@ -1,12 +1,34 @@
 void initSettings();
 void handleSettingsGet();
 void handleSettingsPost();
+// applies changed settings, call from loop()
+void handleSettings();
+// values, defaults and limits of all settings for the settings and root pages
+void handleSettingsJson();
 void save_setting(uint8_t index_setting);
 
 extern int64_t setting_energy_total[4];
 
 extern int64_t setting_sample_count;
 
+extern int64_t setting_zx_pin;
+extern int64_t setting_zx_cycles;
+
+extern int64_t setting_push_format;
+extern int64_t setting_push_port;
+extern int64_t setting_push_interval;
+
+extern int64_t setting_influx_interval;
+extern int64_t setting_influx_batch;
+extern int64_t setting_influx_port;
+
+extern int64_t setting_mqtt_port;
+extern int64_t setting_mqtt_qos;
+extern int64_t setting_mqtt_keepalive;
+extern int64_t setting_mqtt_format;
+extern int64_t setting_mqtt_interval;
+extern int64_t setting_mqtt_inflight;
+
 extern int64_t setting_voltage_gain[3];
 extern int64_t setting_current_gain[3];
 
@@ -19,3 +41,8 @@ extern char setting_wifi_hostname[];
 extern char setting_wifi_ip_fixed[];
 extern char setting_wifi_ip_gateway[];
 extern char setting_wifi_ip_netmask[];
+
+extern char setting_push_target[];
+extern char setting_influx_host[];
+extern char setting_influx_path[];
+extern char setting_mqtt_host[];
@@ -1,71 +1,138 @@
 #include "Arduino.h"
 
-#include <ESP8266WebServer.h>
+#include <ESP8266WiFi.h>
 #include <ESP8266mDNS.h>
-#include <ESP8266HTTPUpdateServer.h>
 
 #include "metrics.h"
+#include "sampler.h"
 #include "ATM90E36.h"
 #include "settings.h"
 #include "globals.h"
 #include "fram.h"
+#include "capture.h"
+#include "history.h"
+#include "binary.h"
+#include "hal.h"
+#include "pages.h"
+#include "push.h"
+#include "influx.h"
+#include "mqtt.h"
+#include "histogram.h"
+#include "response.h"
+#include "web.h"
 
 const char* host = "threephasemeter";
 const char* update_path = "/update";
 const char* update_username = "admin";
 const char* update_password = "admin";
 
-ESP8266WebServer httpServer(80);
-ESP8266HTTPUpdateServer httpUpdater;
+// one value of /status, value() / denominator with decimals fractional digits
+struct StatusValue
+{
+	const char *name;
+	int64_t (*value)();
+	int64_t denominator;
+	uint8_t decimals;
+};
+
+const struct StatusValue status_values[] = {
+	{"spi_read_time_us", []() -> int64_t { return lastMetricReadTime; }, 1, 0},
+	{"free_heap_kbytes", []() -> int64_t { return ESP.getFreeHeap(); }, 1024, 3},
+	{"sample_store_bytes", []() -> int64_t { return sample_store_bytes; }, 1, 0},
+	{"heap_reclaimed_bytes", []() -> int64_t { return sample_store_heap_reclaimed; }, 1, 0},
+	{"logic_voltage", []() -> int64_t { return ESP.getVcc(); }, 1000, 2},
+	{"uptime", []() -> int64_t { return uptime_seconds; }, 1, 0},
+	{"loop_duration_avg_us", []() -> int64_t { return loop_duration; }, 1, 0},
+	{"loop_duration_max_us", []() -> int64_t { return loop_duration_max; }, 1, 0},
+	{"sampling_synchronous", []() -> int64_t { return sampling_synchronous ? 1 : 0; }, 1, 0},
+	{"zero_crossings", []() -> int64_t { return zero_crossing_count; }, 1, 0},
+	{"response_cache_hits", []() -> int64_t { return response_cache_hits; }, 1, 0},
+	{"response_cache_misses", []() -> int64_t { return response_cache_misses; }, 1, 0},
+	{"response_cache_overflows", []() -> int64_t { return response_cache_overflows; }, 1, 0},
+	{"response_part_overflows", []() -> int64_t { return response_part_overflows; }, 1, 0},
+	{"push_packets_sent", []() -> int64_t { return push_packets_sent; }, 1, 0},
+	{"push_packets_dropped", []() -> int64_t { return push_packets_dropped; }, 1, 0},
+	{"influx_records_sent", []() -> int64_t { return influx_records_sent; }, 1, 0},
+	{"influx_records_dropped", []() -> int64_t { return influx_records_dropped; }, 1, 0},
+	{"influx_records_queued", []() -> int64_t { return influxQueued(); }, 1, 0},
+	{"influx_posts_failed", []() -> int64_t { return influx_posts_failed; }, 1, 0},
+	{"clock_synchronized", []() -> int64_t { return halEpochSeconds() ? 1 : 0; }, 1, 0},
+	{"mqtt_connected", []() -> int64_t { return mqttConnected() ? 1 : 0; }, 1, 0},
+	{"mqtt_connects", []() -> int64_t { return mqtt_connects; }, 1, 0},
+	{"mqtt_messages_published", []() -> int64_t { return mqtt_messages_published; }, 1, 0},
+	{"mqtt_messages_dropped", []() -> int64_t { return mqtt_messages_dropped; }, 1, 0},
+	{"mqtt_messages_lost", []() -> int64_t { return mqtt_messages_lost; }, 1, 0}
+};
+#define STATUS_COUNT (sizeof(status_values) / sizeof(status_values[0]))
+
+// cursor.option of /status
+#define STATUS_RESET_MAX (1 << 0)
+#define STATUS_RESET_HISTOGRAMS (1 << 1)
+
+void writeStatus(const char *name, const char *suffix, int64_t numerator, int64_t denominator, uint8_t decimals)
+{
+	writePreamble();
+	responseWrite(name);
+	responseWrite(suffix);
+	responseWrite(" value=");
+	responseWriteFixed(numerator, denominator, decimals);
+	responseWrite('\n');
+}
+
+// one line per part: status_values[], the missed ticks of every tier and the histograms
+bool renderStatus(struct ResponseCursor &cursor)
+{
+	uint16_t line = cursor.part;
+
+	if(line < STATUS_COUNT)
+	{
+		const struct StatusValue &status = status_values[line];
 
-String message_buffer = "";
+		writeStatus(status.name, "", status.value(), status.denominator, status.decimals);
+		return true;
+	}
 
-// WiFiClient pushClient;
+	line -= STATUS_COUNT;
+
+	if(line < TIER_COUNT)
+	{
+		writeStatus("sample_ticks_missed_", sample_tiers[line].name, sample_ticks_missed[line], 1, 0);
+		return true;
+	}
+
+	if(writeHistogramLine(line - TIER_COUNT))
+		return true;
+
+	// the maximum and the histograms start over for the next measurement period (see loadtest.py)
+	if(cursor.option & STATUS_RESET_MAX)
+		loop_duration_max = 0;
+	if(cursor.option & STATUS_RESET_HISTOGRAMS)
+		histogramResetAll();
+
+	return false;
+}
 
 void handleStatus()
 {
-	message_buffer.remove(0);
-
-	String preable = INFLUX_PREAMBLE;
+	struct ResponseCursor cursor = {};
 
-	message_buffer += preable + "spi_read_time_us value=" + String(lastMetricReadTime) + "\n";
-	message_buffer += preable + "free_heap_kbytes value=" + String(((float)ESP.getFreeHeap())/1024, 3) + "\n";
-	message_buffer += preable + "logic_voltage value=" + String(((float)ESP.getVcc())/1000, 2) + "\n";
-	message_buffer += preable + "uptime value=" + String(uptime_seconds) + "\n";
-	message_buffer += preable + "loop_duration_avg_us value=" + String(loop_duration, 0) + "\n";
-	message_buffer += preable + "loop_duration_max_us value=" + String(loop_duration_max, 0) + "\n";
+	if(halHttpHasArg("reset_max"))
+		cursor.option |= STATUS_RESET_MAX;
+	if(halHttpHasArg("reset_histograms"))
+		cursor.option |= STATUS_RESET_HISTOGRAMS;
 
-	httpServer.send(200, "text/plain; version=0.0.4", message_buffer);
+	responseSendParts(200, "text/plain; version=0.0.4", renderStatus, cursor);
 }
 
 void handleReboot()
 {
-	ESP.restart();
+	halHttpSend(200, "text/plain", "rebooting");
+	halRestart();
 }
 
 void handleRoot()
 {
-	message_buffer.remove(0);
-
-	message_buffer +=
-	String("<html>") +
-		"<head>"
-			"<title>" + setting_wifi_hostname + "</title>"
-		"</head>"
-		"<body>"
-			"<h1>" + setting_wifi_hostname + "</h1>"
-			"<h2>Navigation</h2>"
-			"<a href=\"metrics\">main sensor readings</a><br/>"
-			"<a href=\"allmetrics\">all sensor readings</a><br/><br/>"
-			"<a href=\"status\">system status</a><br/>"
-			"<a href=\"info\">system info</a><br/>"
-			"<a href=\"settings\">system settings</a><br/>"
-			"<a href=\"update\">system update</a><br/>"
-			"<a href=\"restart\">system restart</a>"
-		"</body>"
-	"</html>";
-
-	httpServer.send(200, "text/html", message_buffer);
+	halHttpSendStatic(200, "text/html", page_root_html, sizeof(page_root_html));
 }
 
 void handleInfo()
@@ -79,45 +146,62 @@ void handleInfo()
 	message_buffer += "real flash chip size (from id): " + String(ESP.getFlashChipRealSize()) + " bytes\n";
 	message_buffer += "firmware MD5: " + ESP.getSketchMD5() + "\n";
 
-	httpServer.send(200, "text/plain", message_buffer);
+	halHttpSend(200, "text/plain", message_buffer);
 }
 
-void handleRegDump()
+// one register per part
+bool renderRegDump(struct ResponseCursor &cursor)
 {
-	message_buffer.remove(0);
+	if(cursor.part >= 0x87)
+		return false;
 
-	for(uint8_t i = 0; i < 0x87; i++)
-	{
-		message_buffer += "0x" + String(i, HEX) + ": ";
-		message_buffer += "0x" + String(readATM90E36(i), HEX) + "\n";
-	}
+	responseWrite("0x");
+	responseWriteHex(cursor.part);
+	responseWrite(": 0x");
+	responseWriteHex(readATM90E36(cursor.part));
+	responseWrite('\n');
 
-	httpServer.send(200, "text/plain", message_buffer);
+	return true;
+}
+
+void handleRegDump()
+{
+	struct ResponseCursor cursor = {};
+
+	responseSendParts(200, "text/plain", renderRegDump, cursor);
 }
 
 void initWeb()
 {
 	message_buffer.reserve(1024);
 
-	httpUpdater.setup(&httpServer, "/update", "admin", password_ap);
+	halHttpOnUpdate(update_path, update_username, password_ap);
+
+	halHttpOn("/", HAL_HTTP_GET, handleRoot);
 
-	httpServer.on("/", HTTP_GET, handleRoot);
+	halHttpOn("/metrics", HAL_HTTP_GET, handleMetrics);
+	halHttpOn("/metricsnew", HAL_HTTP_GET, handleMetricsNew);
+	halHttpOn("/allmetrics", HAL_HTTP_GET, handleAllMetrics);
+	halHttpOn("/metrics.bin", HAL_HTTP_GET, handleMetricsBinary);
+	halHttpOn("/metrics.schema", HAL_HTTP_GET, handleMetricsSchema);
+	halHttpOn("/rollup", HAL_HTTP_GET, handleRollup);
+	halHttpOn("/history", HAL_HTTP_GET, handleHistory);
 
-	httpServer.on("/metrics", HTTP_GET, handleMetrics);
-	httpServer.on("/metricsnew", HTTP_GET, handleMetricsNew);
-	httpServer.on("/allmetrics", HTTP_GET, handleAllMetrics);
+	halHttpOn("/reboot", HAL_HTTP_GET, handleReboot);
+	halHttpOn("/restart", HAL_HTTP_GET, handleReboot);
 
-	httpServer.on("/reboot", HTTP_GET, handleReboot);
-	httpServer.on("/restart", HTTP_GET, handleReboot);
+	halHttpOn("/status", HAL_HTTP_GET, handleStatus);
+	halHttpOn("/info", HAL_HTTP_GET, handleInfo);
+	halHttpOn("/regdump", HAL_HTTP_GET, handleRegDump);
 
-	httpServer.on("/status", HTTP_GET, handleStatus);
-	httpServer.on("/info", HTTP_GET, handleInfo);
-	httpServer.on("/regdump", HTTP_GET, handleRegDump);
+	halHttpOn("/capture", HAL_HTTP_GET, handleCaptureStart);
+	halHttpOn("/capture.bin", HAL_HTTP_GET, handleCaptureData);
 
-	httpServer.on("/settings", HTTP_GET, handleSettingsGet);
-	httpServer.on("/settings", HTTP_POST, handleSettingsPost);
+	halHttpOn("/settings", HAL_HTTP_GET, handleSettingsGet);
+	halHttpOn("/settings", HAL_HTTP_POST, handleSettingsPost);
+	halHttpOn("/settings.json", HAL_HTTP_GET, handleSettingsJson);
 
-	httpServer.begin();
+	halHttpBegin();
 
 	MDNS.begin(setting_wifi_hostname);
 	MDNS.addService("http", "tcp", 80);
@@ -1,5 +1 @@
-#include <ESP8266WebServer.h>
 void initWeb();
-extern ESP8266WebServer httpServer;
-extern String message_buffer;
-// extern WiFiClient pushClient;